@@ -0,0 +1,243 @@
+/**
+ * Host microbenchmarks for the SSE encoder, the stream compression and the template renderer
+ *
+ * The code under test is compiled from main/ without ESP-IDF.
+ * Sockets and httpd are replaced by fake sinks that copy into memory.
+ * Results are printed as CSV: benchmark,params,ns_per_op,bytes_per_op,allocs_per_op
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sse.h"
+#include "deflate.h"
+#include "template.h"
+
+#define BENCH_MIN_TIME_ns 200000000LL
+#define BENCH_FRAME_SIZE 1024
+#define BENCH_CHUNK_SIZE 4096
+#define BENCH_MAX_SESSIONS 16
+
+//Allocation counting via -Wl,--wrap
+static unsigned long allocs = 0;
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void* __wrap_malloc(size_t size) { allocs++; return __real_malloc(size); }
+void* __wrap_calloc(size_t n, size_t size) { allocs++; return __real_calloc(n, size); }
+void* __wrap_realloc(void* ptr, size_t size) { allocs++; return __real_realloc(ptr, size); }
+
+typedef struct {
+    const char* name;
+    char params[64];
+    unsigned long iterations;
+    long long elapsed_ns;
+    unsigned long long bytes;
+    unsigned long allocs;
+} bench_result_t;
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void report(const bench_result_t* r)
+{
+    printf("%s,%s,%.1f,%.1f,%.2f\n", r->name, r->params,
+            (double)r->elapsed_ns / r->iterations,
+            (double)r->bytes / r->iterations,
+            (double)r->allocs / r->iterations);
+}
+
+//Keeps the compiler from optimizing away the sinks
+static volatile unsigned char sink_guard;
+
+/*
+ * SSE encoder: header, payload copy and trailer into a frame,
+ * followed by the fan-out to every session as done by eventsource_task
+ */
+
+static char frame[BENCH_FRAME_SIZE];
+static char session_sinks[BENCH_MAX_SESSIONS][BENCH_FRAME_SIZE];
+
+static size_t encode_event(int id, const char* event, const char* data, size_t data_len)
+{
+    size_t len = sse_format_header(frame, BENCH_FRAME_SIZE - SSE_TRAILER_LEN, id, event, true);
+    memcpy(frame + len, data, data_len);
+    len += data_len;
+    len += sse_format_trailer(frame + len, true);
+    return len;
+}
+
+static void bench_sse(size_t payload_size, int sessions)
+{
+    char payload[BENCH_FRAME_SIZE];
+    memset(payload, 'x', payload_size);
+
+    bench_result_t r = { .name = "sse_encode" };
+    snprintf(r.params, sizeof(r.params), "payload=%zu;sessions=%d", payload_size, sessions);
+
+    unsigned long allocs_before = allocs;
+    long long start = now_ns();
+    do {
+        for(int n = 0; n < 1000; n++)
+        {
+            size_t len = encode_event((int)r.iterations + n, "telemetry", payload, payload_size);
+            for(int s = 0; s < sessions; s++)
+            {
+                memcpy(session_sinks[s], frame, len);
+                r.bytes += len;
+            }
+        }
+        r.iterations += 1000;
+        r.elapsed_ns = now_ns() - start;
+    } while(r.elapsed_ns < BENCH_MIN_TIME_ns);
+    r.allocs = allocs - allocs_before;
+
+    sink_guard = session_sinks[sessions - 1][0];
+    report(&r);
+}
+
+/*
+ * Stream compression: telemetry events of one session through deflate with a sync flush per event
+ * bytes_per_op is the compressed size of one event, params contain the uncompressed size
+ */
+
+static void bench_deflate(size_t window)
+{
+    static uint8_t mem[DEFLATE_MEMSIZE(32768)];
+    static uint8_t out[DEFLATE_BOUND(BENCH_FRAME_SIZE)];
+    static const int events = 1000;
+    deflate_t d;
+    char data[128];
+    unsigned long long raw = 0;
+
+    bench_result_t r = { .name = "sse_deflate" };
+
+    unsigned long allocs_before = allocs;
+    long long start = now_ns();
+    do {
+        deflate_init(&d, DEFLATE_FORMAT_GZIP, mem, window);
+        raw = 0;
+        srand(1);
+        for(int n = 0; n < events; n++)
+        {
+            //Slowly changing sensor values as sent by a typical telemetry stream
+            int data_len = snprintf(data, sizeof(data), "{\"uptime\":%d,\"temp\":%d.%d,\"humidity\":%d,\"rssi\":%d,\"state\":\"%s\"}",
+                    n * 100, 21 + rand() % 3, rand() % 10, 40 + rand() % 5, -50 - rand() % 20, (n % 50) ? "running" : "idle");
+            size_t len = encode_event(n, "telemetry", data, data_len);
+            raw += len;
+            r.bytes += deflate_write(&d, frame, len, out);
+        }
+        r.iterations += events;
+        r.elapsed_ns = now_ns() - start;
+    } while(r.elapsed_ns < BENCH_MIN_TIME_ns);
+    r.allocs = allocs - allocs_before;
+    snprintf(r.params, sizeof(r.params), "window=%zu;raw_bytes=%.1f", window, (double)raw / events);
+
+    sink_guard = out[0];
+    report(&r);
+}
+
+/*
+ * Template renderer: one chunk of html with placeholders at a fixed density
+ */
+
+typedef struct {
+    char out[BENCH_CHUNK_SIZE * 2];
+    size_t len;
+    unsigned long long total;
+} render_sink_t;
+
+static int render_emit(void* ctx, const char* buf, size_t len)
+{
+    render_sink_t* sink = (render_sink_t*)ctx;
+    if(sink->len + len > sizeof(sink->out)) sink->len = 0;
+    memcpy(sink->out + sink->len, buf, len);
+    sink->len += len;
+    sink->total += len;
+    return 0;
+}
+
+static int render_substitute(void* ctx, uint8_t index)
+{
+    static const char value[] = "42.0";
+    (void)index;
+    return render_emit(ctx, value, sizeof(value) - 1);
+}
+
+static void bench_template(size_t placeholder_every)
+{
+    static char chunk[BENCH_CHUNK_SIZE];
+    static render_sink_t sink;
+
+    size_t placeholders = 0;
+    for(size_t i = 0; i < BENCH_CHUNK_SIZE; i++)
+    {
+        bool is_placeholder = placeholder_every && (i % placeholder_every) == placeholder_every - 1;
+        chunk[i] = is_placeholder ? '$' : 'a' + (i % 26);
+        if(is_placeholder) placeholders++;
+    }
+
+    template_renderer_t renderer = {
+            .placeholder = '$',
+            .emit = render_emit,
+            .substitute = render_substitute,
+            .ctx = &sink
+    };
+
+    bench_result_t r = { .name = "template_render" };
+    snprintf(r.params, sizeof(r.params), "chunk=%d;placeholders=%zu", BENCH_CHUNK_SIZE, placeholders);
+
+    unsigned long allocs_before = allocs;
+    long long start = now_ns();
+    do {
+        for(int n = 0; n < 100; n++)
+        {
+            renderer.index = 0;
+            template_render_chunk(&renderer, chunk, BENCH_CHUNK_SIZE);
+        }
+        r.iterations += 100;
+        r.elapsed_ns = now_ns() - start;
+    } while(r.elapsed_ns < BENCH_MIN_TIME_ns);
+    r.allocs = allocs - allocs_before;
+    r.bytes = sink.total;
+    sink.total = 0;
+
+    sink_guard = sink.out[0];
+    report(&r);
+}
+
+int main(void)
+{
+    static const size_t payload_sizes[] = { 0, 16, 128, 512, 960 };
+    static const int session_counts[] = { 1, 5, 16 };
+    static const size_t placeholder_spacing[] = { 0, 1024, 128, 16, 2 };
+    static const size_t deflate_windows[] = { 256, 1024, 4096 };
+
+    printf("benchmark,params,ns_per_op,bytes_per_op,allocs_per_op\n");
+
+    for(size_t p = 0; p < sizeof(payload_sizes)/sizeof(payload_sizes[0]); p++)
+    {
+        for(size_t s = 0; s < sizeof(session_counts)/sizeof(session_counts[0]); s++)
+        {
+            bench_sse(payload_sizes[p], session_counts[s]);
+        }
+    }
+
+    for(size_t w = 0; w < sizeof(deflate_windows)/sizeof(deflate_windows[0]); w++)
+    {
+        bench_deflate(deflate_windows[w]);
+    }
+
+    for(size_t p = 0; p < sizeof(placeholder_spacing)/sizeof(placeholder_spacing[0]); p++)
+    {
+        bench_template(placeholder_spacing[p]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,182 @@
+/**
+ * Host check of the stream compression against zlib
+ *
+ * Every stream is decoded by inflate after each deflate_write call and has to match the input written so far,
+ * because every call ends with a sync flush. Covers the three framings, empty writes,
+ * writes at arbitrary boundaries, single writes larger than the window and streams much longer than the window.
+ * Prints one line per failure and exits with 1 if there was any.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "deflate.h"
+
+#define CHECK_STREAM_SIZE (100 * 1024)
+
+static uint8_t mem[DEFLATE_MEMSIZE(32768)];
+static char input[CHECK_STREAM_SIZE];
+static uint8_t out[DEFLATE_BOUND(CHECK_STREAM_SIZE)];
+static uint8_t decoded[CHECK_STREAM_SIZE];
+
+static const char* const format_names[] = { "zlib", "gzip", "raw" };
+static const int format_window_bits[] = { 15, 16 + 15, -15 };
+
+static int cases = 0;
+static int failures = 0;
+
+//Deterministic xorshift, the same inputs and boundaries on every run
+static uint32_t rng_state;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+typedef enum {
+    INPUT_TELEMETRY = 0,    //Similar JSON events, many short matches
+    INPUT_RANDOM,           //Incompressible bytes
+    INPUT_HIGH,             //Random bytes with 9 bit literal codes, the worst case of DEFLATE_BOUND
+    INPUT_RUNS,             //Long runs and repeated blocks, overlapping and maximum length matches
+    INPUT_COUNT
+} input_kind_t;
+
+static const char* const input_names[] = { "telemetry", "random", "high", "runs" };
+
+static void fill_input(input_kind_t kind, size_t len)
+{
+    size_t i = 0;
+    while(i < len)
+    {
+        switch(kind)
+        {
+        case INPUT_TELEMETRY:
+        {
+            char event[128];
+            int n = snprintf(event, sizeof(event), "id: %u\nevent: telemetry\ndata: {\"temp\":%u.%u,\"rssi\":-%u}\n\n",
+                    (unsigned)i, 20 + rng() % 5, rng() % 10, 40 + rng() % 30);
+            for(int k = 0; k < n && i < len; k++) input[i++] = event[k];
+            break;
+        }
+        case INPUT_RANDOM:
+            input[i++] = (char)rng();
+            break;
+        case INPUT_HIGH:
+            input[i++] = (char)(144 + rng() % 112);
+            break;
+        case INPUT_RUNS:
+        {
+            size_t n = 1 + rng() % 600;
+            if(rng() % 2 && i >= 1024)
+            {
+                //Repeat an earlier block, possibly further back than the window
+                size_t from = rng() % (i - 512);
+                for(size_t k = 0; k < n && i < len; k++) input[i++] = input[from + k % 512];
+            }
+            else
+            {
+                char c = (char)rng();
+                for(size_t k = 0; k < n && i < len; k++) input[i++] = c;
+            }
+            break;
+        }
+        default:
+            return;
+        }
+    }
+}
+
+/**
+ * Compresses @param len bytes of input in writes of up to @param max_write bytes (0 for a single write)
+ * and decodes the stream after every write
+ */
+static void check_stream(deflate_format_t format, size_t window, input_kind_t kind, size_t len, size_t max_write)
+{
+    deflate_t d;
+    z_stream z;
+    char name[96];
+
+    snprintf(name, sizeof(name), "format=%s;window=%zu;input=%s;len=%zu;max_write=%zu",
+            format_names[format], window, input_names[kind], len, max_write);
+    cases++;
+
+    memset(&z, 0, sizeof(z));
+    if(inflateInit2(&z, format_window_bits[format]) != Z_OK)
+    {
+        printf("FAIL %s: inflateInit2\n", name);
+        failures++;
+        return;
+    }
+    deflate_init(&d, format, mem, window);
+
+    size_t pos = 0;
+    int writes = 0;
+    do {
+        size_t n = len - pos;
+        //Every tenth write is empty, an empty write still has to produce a valid stream
+        if(max_write && n) n = (rng() % 10 == 0) ? 0 : 1 + rng() % (n < max_write ? n : max_write);
+
+        size_t out_len = deflate_write(&d, input + pos, n, out);
+        if(out_len > DEFLATE_BOUND(n))
+        {
+            printf("FAIL %s: write %d of %zu bytes produced %zu bytes, more than DEFLATE_BOUND\n", name, writes, n, out_len);
+            failures++;
+            break;
+        }
+
+        z.next_in = out;
+        z.avail_in = out_len;
+        z.next_out = decoded + pos;
+        z.avail_out = sizeof(decoded) - pos;
+        int ret = inflate(&z, Z_SYNC_FLUSH);
+        pos += n;
+        writes++;
+        if(ret != Z_OK || z.avail_in != 0)
+        {
+            printf("FAIL %s: inflate returned %d (%s) at write %d\n", name, ret, z.msg ? z.msg : "", writes);
+            failures++;
+            break;
+        }
+        if(z.total_out != pos || memcmp(decoded, input, pos))
+        {
+            printf("FAIL %s: decoded %lu bytes differ from the %zu bytes written after write %d\n",
+                    name, z.total_out, pos, writes);
+            failures++;
+            break;
+        }
+    } while(pos < len);
+
+    inflateEnd(&z);
+}
+
+int main(void)
+{
+    static const size_t windows[] = { 64, 256, 1024, 4096, 32768 };
+
+    for(int format = DEFLATE_FORMAT_ZLIB; format <= DEFLATE_FORMAT_RAW; format++)
+    {
+        //Empty input: only the header and a sync flush
+        check_stream(format, 1024, INPUT_TELEMETRY, 0, 0);
+
+        for(size_t w = 0; w < sizeof(windows)/sizeof(windows[0]); w++)
+        {
+            for(int kind = 0; kind < INPUT_COUNT; kind++)
+            {
+                rng_state = 0x9E3779B9u + format * 131 + w * 17 + kind;
+                fill_input(kind, CHECK_STREAM_SIZE);
+                //One write of the whole stream, short writes like events and writes of a few windows
+                check_stream(format, windows[w], kind, CHECK_STREAM_SIZE, 0);
+                check_stream(format, windows[w], kind, CHECK_STREAM_SIZE, 200);
+                check_stream(format, windows[w], kind, CHECK_STREAM_SIZE, 3 * windows[w]);
+            }
+        }
+    }
+
+    printf("deflate_check: %d of %d streams decoded correctly\n", cases - failures, cases);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,97 @@
+#include "bootprof.h"
+
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#define BOOTPROF_MAX_PHASES 16
+
+static const char* TAG = "BOOT";
+
+typedef struct {
+    const char* phase;
+    int64_t start_us;
+    int64_t end_us;
+} bootprof_entry_t;
+
+static bootprof_entry_t entries[BOOTPROF_MAX_PHASES];
+static uint8_t entry_count = 0;
+static portMUX_TYPE entries_mux = portMUX_INITIALIZER_UNLOCKED;
+
+int64_t bootprof_now(void)
+{
+    return esp_timer_get_time();
+}
+
+static bool record(const char* phase, int64_t start_us, int64_t end_us, bool once)
+{
+    bool recorded = false;
+    portENTER_CRITICAL(&entries_mux);
+    bool found = false;
+    if(once)
+    {
+        for(uint8_t i = 0; i < entry_count; i++)
+        {
+            if(entries[i].phase == phase) found = true;
+        }
+    }
+    if(!found && entry_count < BOOTPROF_MAX_PHASES)
+    {
+        entries[entry_count].phase = phase;
+        entries[entry_count].start_us = start_us;
+        entries[entry_count].end_us = end_us;
+        entry_count++;
+        recorded = true;
+    }
+    portEXIT_CRITICAL(&entries_mux);
+    return recorded;
+}
+
+/**
+ * Records that @param phase which began at @param start_us ended now
+ * @param phase has to be a string literal
+ */
+void bootprof_mark(const char* phase, int64_t start_us)
+{
+    int64_t now = bootprof_now();
+    if(record(phase, start_us, now, false))
+    {
+        ESP_LOGI(TAG, "%s: %lld us (at %lld us)", phase, (long long)(now - start_us), (long long)now);
+    }
+}
+
+/**
+ * Records the first occurrence of the milestone @param phase, e.g. the first served request
+ * @param phase has to be a string literal
+ */
+void bootprof_mark_once(const char* phase)
+{
+    int64_t now = bootprof_now();
+    if(record(phase, now, now, true))
+    {
+        ESP_LOGI(TAG, "%s at %lld us", phase, (long long)now);
+    }
+}
+
+/**
+ * Logs all recorded phases in the order they finished
+ */
+void bootprof_report(void)
+{
+    bootprof_entry_t copy[BOOTPROF_MAX_PHASES];
+    portENTER_CRITICAL(&entries_mux);
+    uint8_t count = entry_count;
+    for(uint8_t i = 0; i < count; i++)
+    {
+        copy[i] = entries[i];
+    }
+    portEXIT_CRITICAL(&entries_mux);
+
+    ESP_LOGI(TAG, "%-20s %10s %10s %10s", "phase", "start_us", "end_us", "took_us");
+    for(uint8_t i = 0; i < count; i++)
+    {
+        ESP_LOGI(TAG, "%-20s %10lld %10lld %10lld", copy[i].phase,
+                (long long)copy[i].start_us, (long long)copy[i].end_us, (long long)(copy[i].end_us - copy[i].start_us));
+    }
+}
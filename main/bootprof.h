@@ -0,0 +1,16 @@
+#ifndef BOOTPROF_H
+#define BOOTPROF_H
+
+#include <stdint.h>
+
+/**
+ * Records the duration of boot phases and reports them as a timeline
+ * Timestamps are microseconds since boot (esp_timer)
+ */
+
+int64_t bootprof_now(void);
+void bootprof_mark(const char* phase, int64_t start_us);
+void bootprof_mark_once(const char* phase);
+void bootprof_report(void);
+
+#endif
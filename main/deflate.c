@@ -0,0 +1,201 @@
+#include "deflate.h"
+
+#include <string.h>
+
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_END_OF_BLOCK 256
+
+static const uint8_t gzip_header[] = { 0x1F, 0x8B, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF };
+//32k window, no dictionary, fastest compression
+static const uint8_t zlib_header[] = { 0x78, 0x01 };
+
+static const uint16_t length_base[] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t length_extra[] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t dist_base[] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t dist_extra[] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+typedef struct {
+    deflate_t* d;
+    uint8_t* out;
+    size_t len;
+} bitwriter_t;
+
+static void put_bits(bitwriter_t* w, uint32_t bits, uint8_t count)
+{
+    deflate_t* d = w->d;
+    d->bitbuf |= bits << d->bitcount;
+    d->bitcount += count;
+    while(d->bitcount >= 8)
+    {
+        w->out[w->len++] = d->bitbuf & 0xFF;
+        d->bitbuf >>= 8;
+        d->bitcount -= 8;
+    }
+}
+
+//Huffman codes are stored most significant bit first
+static void put_code(bitwriter_t* w, uint32_t code, uint8_t count)
+{
+    uint32_t reversed = 0;
+    for(uint8_t i = 0; i < count; i++)
+    {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+    put_bits(w, reversed, count);
+}
+
+//Literal/length symbol with the fixed code of RFC 1951 3.2.6
+static void put_symbol(bitwriter_t* w, uint16_t sym)
+{
+    if(sym < 144) put_code(w, 0x30 + sym, 8);
+    else if(sym < 256) put_code(w, 0x190 + sym - 144, 9);
+    else if(sym < 280) put_code(w, sym - 256, 7);
+    else put_code(w, 0xC0 + sym - 280, 8);
+}
+
+static void put_match(bitwriter_t* w, size_t len, size_t dist)
+{
+    uint8_t l = 0;
+    while(l < 28 && length_base[l + 1] <= len) l++;
+    put_symbol(w, 257 + l);
+    if(length_extra[l]) put_bits(w, len - length_base[l], length_extra[l]);
+
+    uint8_t c = 0;
+    while(c < 29 && dist_base[c + 1] <= dist) c++;
+    put_code(w, c, 5);
+    if(dist_extra[c]) put_bits(w, dist - dist_base[c], dist_extra[c]);
+}
+
+static inline uint32_t hash3(const uint8_t* p, uint32_t mask)
+{
+    return (((uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2]) * 2654435761u >> 16) & mask;
+}
+
+/**
+ * Prepares a stream in @param mem of DEFLATE_MEMSIZE(@param window) bytes
+ * Smaller windows use less memory, but find fewer repetitions
+ */
+void deflate_init(deflate_t* d, deflate_format_t format, void* mem, size_t window)
+{
+    memset(mem, 0, DEFLATE_MEMSIZE(window));
+    d->window = (uint8_t*)mem;
+    d->hash = (uint16_t*)((uint8_t*)mem + window);
+    d->window_mask = window - 1;
+    d->hash_mask = window / 2 - 1;
+    d->pos = 0;
+    d->bitbuf = 0;
+    d->bitcount = 0;
+    d->format = format;
+    d->header_sent = false;
+}
+
+/**
+ * Compresses @param len bytes of @param in as one block followed by a sync flush
+ * @param out needs room for DEFLATE_BOUND(len) bytes
+ * @return number of bytes written to @param out
+ */
+size_t deflate_write(deflate_t* d, const char* in, size_t len, uint8_t* out)
+{
+    bitwriter_t w = { .d = d, .out = out, .len = 0 };
+    const uint8_t* src = (const uint8_t*)in;
+    uint32_t window = d->window_mask + 1;
+
+    if(!d->header_sent)
+    {
+        if(d->format == DEFLATE_FORMAT_GZIP)
+        {
+            memcpy(out, gzip_header, sizeof(gzip_header));
+            w.len = sizeof(gzip_header);
+        }
+        else if(d->format == DEFLATE_FORMAT_ZLIB)
+        {
+            memcpy(out, zlib_header, sizeof(zlib_header));
+            w.len = sizeof(zlib_header);
+        }
+        d->header_sent = true;
+    }
+
+    if(len)
+    {
+        //Not final, fixed Huffman codes
+        put_bits(&w, 0, 1);
+        put_bits(&w, 1, 2);
+
+        uint32_t base = d->pos;
+        size_t i = 0;
+        while(i < len)
+        {
+            uint32_t cur = base + i;
+            size_t best_len = 0;
+            uint32_t best_dist = 0;
+
+            if(len - i >= DEFLATE_MIN_MATCH)
+            {
+                uint32_t h = hash3(src + i, d->hash_mask);
+                uint32_t dist = (cur - d->hash[h]) & 0xFFFF;
+                d->hash[h] = cur & 0xFFFF;
+
+                //The candidate may be stale, the bytes are compared anyway
+                if(dist > 0 && dist < window && dist <= cur)
+                {
+                    size_t max = len - i;
+                    if(max > DEFLATE_MAX_MATCH) max = DEFLATE_MAX_MATCH;
+                    size_t n = 0;
+                    while(n < max)
+                    {
+                        uint32_t ref = cur + n - dist;
+                        //Overlapping matches reach into the input of this call
+                        uint8_t b = (ref < base) ? d->window[ref & d->window_mask] : src[ref - base];
+                        if(b != src[i + n]) break;
+                        n++;
+                    }
+                    best_len = n;
+                    best_dist = dist;
+                }
+            }
+
+            size_t advance = 1;
+            if(best_len >= DEFLATE_MIN_MATCH)
+            {
+                put_match(&w, best_len, best_dist);
+                advance = best_len;
+                //Index the skipped positions so later events can refer to them
+                for(size_t k = 1; k < best_len && i + k + DEFLATE_MIN_MATCH <= len; k++)
+                {
+                    d->hash[hash3(src + i + k, d->hash_mask)] = (cur + k) & 0xFFFF;
+                }
+            }
+            else
+            {
+                put_symbol(&w, src[i]);
+            }
+
+            for(size_t k = 0; k < advance; k++)
+            {
+                d->window[(cur + k) & d->window_mask] = src[i + k];
+            }
+            i += advance;
+        }
+        d->pos += len;
+        put_symbol(&w, DEFLATE_END_OF_BLOCK);
+    }
+
+    //Sync flush: empty stored block, aligned to a byte boundary
+    put_bits(&w, 0, 3);
+    if(d->bitcount) put_bits(&w, 0, 8 - d->bitcount);
+    out[w.len++] = 0x00;
+    out[w.len++] = 0x00;
+    out[w.len++] = 0xFF;
+    out[w.len++] = 0xFF;
+    return w.len;
+}
@@ -0,0 +1,43 @@
+#ifndef NET_DEFLATE_H
+#define NET_DEFLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Small streaming deflate encoder (RFC 1951) for Server-Sent-Events streams
+ * Uses fixed Huffman codes and a ring window of a few kB, so one stream costs 2 * window bytes of memory.
+ * Every call ends with a sync flush, the client can decode everything written so far.
+ * The stream is never finished, it ends when the connection is closed.
+ * Doesn't depend on ESP-IDF and doesn't allocate.
+ */
+
+typedef enum {
+    DEFLATE_FORMAT_ZLIB = 0,    //Content-Encoding: deflate
+    DEFLATE_FORMAT_GZIP,        //Content-Encoding: gzip
+    DEFLATE_FORMAT_RAW
+} deflate_format_t;
+
+typedef struct {
+    uint8_t* window;
+    uint16_t* hash;
+    uint32_t window_mask;
+    uint32_t hash_mask;
+    uint32_t pos;               //Number of bytes compressed so far
+    uint32_t bitbuf;
+    uint8_t bitcount;
+    deflate_format_t format;
+    bool header_sent;
+} deflate_t;
+
+//Memory needed for a window of @param window bytes (power of two, at most 32768)
+#define DEFLATE_MEMSIZE(window) ((window) + ((window) / 2) * sizeof(uint16_t))
+
+//Largest output of one deflate_write call for @param len input bytes
+#define DEFLATE_BOUND(len) ((len) + (len) / 8 + 20)
+
+void deflate_init(deflate_t* d, deflate_format_t format, void* mem, size_t window);
+size_t deflate_write(deflate_t* d, const char* in, size_t len, uint8_t* out);
+
+#endif
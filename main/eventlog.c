@@ -0,0 +1,575 @@
+#include "eventlog.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include "mempool.h"
+
+//Events collected in RAM before they are written in one go
+#define EVENTLOG_BATCH_SIZE 2048
+#define EVENTLOG_FLUSH_INTERVAL_ms 1000
+//A new segment is started once the newest one exceeds this size
+#define EVENTLOG_SEGMENT_SIZE 16384
+//The oldest segment is deleted when a new one would exceed this count
+#define EVENTLOG_MAX_SEGMENTS 8
+#define EVENTLOG_MAX_LOGS 2
+#define EVENTLOG_PATH_SIZE 32
+#define EVENTLOG_TASK_STACK 3072
+#define EVENTLOG_TASK_PRIORITY 2
+
+static const char* TAG = "NET/EventLog";
+
+//Header in front of every event, in flash and in the RAM batches
+typedef struct __attribute__((packed)) {
+    int32_t id;
+    uint16_t len;
+} record_t;
+
+typedef struct {
+    uint32_t seq;
+    int first_id;
+} segment_t;
+
+struct eventlog {
+    char path[EVENTLOG_PATH_SIZE];
+
+    //Segment index and files, protected by file_lock
+    SemaphoreHandle_t file_lock;
+    bool opened;                    //Existing segments were scanned, see log_open
+    segment_t segments[EVENTLOG_MAX_SEGMENTS];
+    uint8_t segment_count;
+    size_t segment_size;            //Size of the newest segment
+
+    //RAM batches. Publishing never waits for flash
+    //batch_mux only protects the fields below, events are copied and scanned outside of it:
+    //bytes below batch_len don't change until the batch is flushed, which changes flushed_id
+    portMUX_TYPE batch_mux;
+    uint8_t batch[2][EVENTLOG_BATCH_SIZE];
+    size_t batch_len[2];
+    uint8_t active;                 //Batch events are appended to, the other one belongs to the flush task
+    bool appending;                 //An event is copied behind batch_len[active], the flush task must not take it
+    int last_id;
+    int flushed_id;
+    unsigned int dropped;
+
+#if MEMPOOL_STATIC
+    StaticSemaphore_t file_lock_mem;
+#endif
+};
+
+static eventlog_t* logs[EVENTLOG_MAX_LOGS];
+static SemaphoreHandle_t logs_lock = NULL;
+static TaskHandle_t flush_task = NULL;
+
+#if MEMPOOL_STATIC
+static eventlog_t logs_mem[EVENTLOG_MAX_LOGS];
+static bool logs_used[EVENTLOG_MAX_LOGS];
+static StaticSemaphore_t logs_lock_mem;
+static StackType_t flush_task_stack[EVENTLOG_TASK_STACK];
+static StaticTask_t flush_task_mem;
+#endif
+
+static void segment_name(eventlog_t* log, uint32_t seq, char* name, size_t size)
+{
+    snprintf(name, size, "%s.%u", log->path, (unsigned)seq);
+}
+
+//Reads the id of the first record and optionally finds the end of the last complete record
+static bool segment_scan(eventlog_t* log, uint32_t seq, int* first_id, int* last_id, size_t* end)
+{
+    char name[EVENTLOG_PATH_SIZE + 12];
+    segment_name(log, seq, name, sizeof(name));
+    FILE* f = fopen(name, "r");
+    if(f == NULL) return false;
+
+    record_t rec;
+    size_t pos = 0;
+    bool found = false;
+    while(fread(&rec, sizeof(rec), 1, f) == 1)
+    {
+        if(!found) *first_id = rec.id;
+        found = true;
+        if(last_id == NULL || fseek(f, rec.len, SEEK_CUR)) break;
+        //fseek succeeds beyond the end of the file, a torn record is detected by the size
+        if(ftell(f) < 0 || (size_t)ftell(f) > pos + sizeof(rec) + rec.len) break;
+        pos += sizeof(rec) + rec.len;
+        *last_id = rec.id;
+    }
+    if(end != NULL)
+    {
+        fseek(f, 0, SEEK_END);
+        *end = (ftell(f) == (long)pos) ? pos : 0;
+    }
+    fclose(f);
+    return found;
+}
+
+//Finds the segments left by a previous boot. Must hold file_lock
+static esp_err_t log_open(eventlog_t* log)
+{
+    char dir[EVENTLOG_PATH_SIZE];
+    const char* base = strrchr(log->path, '/');
+    if(base == NULL) return ESP_ERR_INVALID_ARG;
+    size_t dir_len = base - log->path;
+    memcpy(dir, log->path, dir_len);
+    dir[dir_len] = 0;
+    base++;
+    size_t base_len = strlen(base);
+
+    //Fails until the filesystem is mounted
+    DIR* d = opendir(dir);
+    if(d == NULL) return ESP_FAIL;
+
+    log->segment_count = 0;
+    struct dirent* entry;
+    while((entry = readdir(d)) != NULL)
+    {
+        if(strncmp(entry->d_name, base, base_len) || entry->d_name[base_len] != '.') continue;
+        uint32_t seq = strtoul(entry->d_name + base_len + 1, NULL, 10);
+
+        //Insert sorted by sequence number, dropping the oldest if there are too many
+        uint8_t n = log->segment_count;
+        if(n == EVENTLOG_MAX_SEGMENTS)
+        {
+            if(seq < log->segments[0].seq) continue;
+            memmove(&log->segments[0], &log->segments[1], --n * sizeof(segment_t));
+        }
+        while(n > 0 && log->segments[n - 1].seq > seq)
+        {
+            log->segments[n] = log->segments[n - 1];
+            n--;
+        }
+        log->segments[n].seq = seq;
+        log->segments[n].first_id = -1;
+        if(log->segment_count < EVENTLOG_MAX_SEGMENTS) log->segment_count++;
+    }
+    closedir(d);
+
+    int last_id = -1;
+    log->segment_size = EVENTLOG_SEGMENT_SIZE;
+    for(uint8_t i = 0; i < log->segment_count; i++)
+    {
+        bool newest = (i == log->segment_count - 1);
+        size_t end = 0;
+        segment_scan(log, log->segments[i].seq, &log->segments[i].first_id, newest ? &last_id : NULL, newest ? &end : NULL);
+        //Appending behind a torn record would corrupt the segment, continue in a new one instead
+        if(newest && end) log->segment_size = end;
+    }
+
+    portENTER_CRITICAL(&log->batch_mux);
+    log->flushed_id = last_id;
+    if(last_id > log->last_id) log->last_id = last_id;
+    portEXIT_CRITICAL(&log->batch_mux);
+
+    log->opened = true;
+    ESP_LOGI(TAG, "Opened %s with %u segments, last id %d", log->path, log->segment_count, last_id);
+    return ESP_OK;
+}
+
+//Writes the batch that isn't appended to. Must only be called by eventlog_task or with logs_lock held
+static void log_flush(eventlog_t* log)
+{
+    xSemaphoreTake(log->file_lock, portMAX_DELAY);
+    if(!log->opened && log_open(log) != ESP_OK)
+    {
+        //Keep the events in RAM until the filesystem is available
+        xSemaphoreGive(log->file_lock);
+        return;
+    }
+
+    portENTER_CRITICAL(&log->batch_mux);
+    uint8_t b = !log->active;
+    if(log->batch_len[b] == 0 && log->batch_len[log->active] > 0 && !log->appending)
+    {
+        log->active = b;
+        b = !b;
+    }
+    size_t len = log->batch_len[b];
+    portEXIT_CRITICAL(&log->batch_mux);
+
+    if(len == 0)
+    {
+        xSemaphoreGive(log->file_lock);
+        return;
+    }
+
+    //Only this function modifies the batch while it isn't active
+    uint8_t* batch = log->batch[b];
+    record_t rec;
+    memcpy(&rec, batch, sizeof(rec));
+    int first_id = rec.id;
+    int last_id = first_id;
+    for(size_t pos = 0; pos < len; pos += sizeof(rec) + rec.len)
+    {
+        memcpy(&rec, batch + pos, sizeof(rec));
+        last_id = rec.id;
+    }
+
+    if(log->segment_count == 0 || log->segment_size >= EVENTLOG_SEGMENT_SIZE)
+    {
+        uint32_t seq = log->segment_count ? log->segments[log->segment_count - 1].seq + 1 : 0;
+        if(log->segment_count == EVENTLOG_MAX_SEGMENTS)
+        {
+            char name[EVENTLOG_PATH_SIZE + 12];
+            segment_name(log, log->segments[0].seq, name, sizeof(name));
+            remove(name);
+            memmove(&log->segments[0], &log->segments[1], --log->segment_count * sizeof(segment_t));
+        }
+        log->segments[log->segment_count].seq = seq;
+        log->segments[log->segment_count].first_id = first_id;
+        log->segment_count++;
+        log->segment_size = 0;
+    }
+
+    char name[EVENTLOG_PATH_SIZE + 12];
+    segment_name(log, log->segments[log->segment_count - 1].seq, name, sizeof(name));
+    FILE* f = fopen(name, "a");
+    if(f == NULL || fwrite(batch, 1, len, f) != len)
+    {
+        ESP_LOGE(TAG, "Failed to write %u bytes to %s", (unsigned)len, name);
+    }
+    if(f != NULL) fclose(f);
+    log->segment_size += len;
+    xSemaphoreGive(log->file_lock);
+
+    portENTER_CRITICAL(&log->batch_mux);
+    log->batch_len[b] = 0;
+    log->flushed_id = last_id;
+    portEXIT_CRITICAL(&log->batch_mux);
+}
+
+static void eventlog_task(void* param)
+{
+    while(true)
+    {
+        ulTaskNotifyTake(pdTRUE, EVENTLOG_FLUSH_INTERVAL_ms/portTICK_PERIOD_MS);
+        xSemaphoreTake(logs_lock, portMAX_DELAY);
+        for(uint8_t i = 0; i < EVENTLOG_MAX_LOGS; i++)
+        {
+            if(logs[i] != NULL) log_flush(logs[i]);
+        }
+        xSemaphoreGive(logs_lock);
+    }
+}
+
+/**
+ * Creates a log stored in files starting with @param path, e.g. "/spiffs/events"
+ * The files are opened by the flush task as soon as the filesystem is mounted
+ */
+esp_err_t eventlog_init(eventlog_t** handle, const char* path)
+{
+    *handle = NULL;
+    if(strlen(path) >= EVENTLOG_PATH_SIZE || strrchr(path, '/') == NULL) return ESP_ERR_INVALID_ARG;
+
+    if(logs_lock == NULL)
+    {
+#if MEMPOOL_STATIC
+        logs_lock = xSemaphoreCreateMutexStatic(&logs_lock_mem);
+        flush_task = xTaskCreateStatic(eventlog_task, "eventlog", EVENTLOG_TASK_STACK, NULL, EVENTLOG_TASK_PRIORITY, flush_task_stack, &flush_task_mem);
+#else
+        logs_lock = xSemaphoreCreateMutex();
+        xTaskCreate(eventlog_task, "eventlog", EVENTLOG_TASK_STACK, NULL, EVENTLOG_TASK_PRIORITY, &flush_task);
+#endif
+    }
+
+    eventlog_t* log = NULL;
+    xSemaphoreTake(logs_lock, portMAX_DELAY);
+    for(uint8_t i = 0; i < EVENTLOG_MAX_LOGS && log == NULL; i++)
+    {
+        if(logs[i] != NULL) continue;
+#if MEMPOOL_STATIC
+        if(logs_used[i]) continue;
+        logs_used[i] = true;
+        log = &logs_mem[i];
+        memset(log, 0, sizeof(eventlog_t));
+#else
+        log = calloc(1, sizeof(eventlog_t));
+        if(log == NULL) break;
+#endif
+        strcpy(log->path, path);
+        portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+        log->batch_mux = mux;
+        log->last_id = -1;
+        log->flushed_id = -1;
+#if MEMPOOL_STATIC
+        log->file_lock = xSemaphoreCreateMutexStatic(&log->file_lock_mem);
+#else
+        log->file_lock = xSemaphoreCreateMutex();
+#endif
+        logs[i] = log;
+    }
+    xSemaphoreGive(logs_lock);
+
+    if(log == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create log %s", path);
+        return ESP_ERR_NO_MEM;
+    }
+    *handle = log;
+    return ESP_OK;
+}
+
+/**
+ * Writes the remaining events and releases the log
+ */
+void eventlog_deinit(eventlog_t* log)
+{
+    if(log == NULL) return;
+
+    xSemaphoreTake(logs_lock, portMAX_DELAY);
+    //Both batches may hold events
+    log_flush(log);
+    log_flush(log);
+    for(uint8_t i = 0; i < EVENTLOG_MAX_LOGS; i++)
+    {
+        if(logs[i] == log)
+        {
+            logs[i] = NULL;
+#if MEMPOOL_STATIC
+            logs_used[i] = false;
+#endif
+        }
+    }
+    xSemaphoreGive(logs_lock);
+
+    vSemaphoreDelete(log->file_lock);
+#if !MEMPOOL_STATIC
+    free(log);
+#endif
+}
+
+/**
+ * Appends the event @param buf with @param id, ids have to increase also across reboots (see eventlog_get_last_id)
+ * Only copies to RAM, the event is written to flash by the flush task. Must not be called by several tasks at once
+ * @return ESP_ERR_NO_MEM if the flush task falls behind and the event was dropped
+ */
+esp_err_t eventlog_append(eventlog_t* log, int id, const char* buf, size_t len)
+{
+    if(len > EVENTLOG_BATCH_SIZE - sizeof(record_t)) return ESP_ERR_INVALID_SIZE;
+
+    esp_err_t ret = ESP_OK;
+    bool notify = false;
+    record_t rec = { .id = id, .len = len };
+
+    portENTER_CRITICAL(&log->batch_mux);
+    uint8_t b = log->active;
+    if(id <= log->last_id)
+    {
+        ret = ESP_ERR_INVALID_ARG;
+    }
+    else if(log->batch_len[b] + sizeof(rec) + len > EVENTLOG_BATCH_SIZE)
+    {
+        //Hand the full batch to the flush task if it is done with the other one
+        if(log->batch_len[!b] == 0)
+        {
+            log->active = !b;
+            b = !b;
+            notify = true;
+        }
+        else
+        {
+            log->dropped++;
+            ret = ESP_ERR_NO_MEM;
+        }
+    }
+    size_t pos = log->batch_len[b];
+    log->appending = (ret == ESP_OK);
+    portEXIT_CRITICAL(&log->batch_mux);
+
+    if(ret == ESP_OK)
+    {
+        //Readers only look below batch_len, the event becomes visible once it is complete
+        memcpy(log->batch[b] + pos, &rec, sizeof(rec));
+        memcpy(log->batch[b] + pos + sizeof(rec), buf, len);
+
+        portENTER_CRITICAL(&log->batch_mux);
+        log->batch_len[b] = pos + sizeof(rec) + len;
+        log->last_id = id;
+        log->appending = false;
+        portEXIT_CRITICAL(&log->batch_mux);
+    }
+
+    if(notify) xTaskNotifyGive(flush_task);
+    return ret;
+}
+
+/**
+ * @return id of the newest event in the log or -1, including events of previous boots once the filesystem is mounted
+ */
+int eventlog_get_last_id(eventlog_t* log)
+{
+    portENTER_CRITICAL(&log->batch_mux);
+    int id = log->last_id;
+    portEXIT_CRITICAL(&log->batch_mux);
+    return id;
+}
+
+/**
+ * @return number of events that weren't logged because flash writes fell behind
+ */
+unsigned int eventlog_get_dropped(eventlog_t* log)
+{
+    return log->dropped;
+}
+
+/**
+ * Positions @param cursor after the event with @param last_id
+ */
+void eventlog_cursor_init(eventlog_cursor_t* cursor, int last_id)
+{
+    cursor->last_id = last_id;
+    cursor->file = NULL;
+    cursor->seq = 0;
+    cursor->in_ram = false;
+    cursor->flushed_id = -1;
+}
+
+void eventlog_cursor_close(eventlog_cursor_t* cursor)
+{
+    if(cursor->file != NULL) fclose(cursor->file);
+    cursor->file = NULL;
+}
+
+//Opens the segment that contains the event after last_id or the next one after seq. Must hold file_lock
+static bool cursor_open(eventlog_t* log, eventlog_cursor_t* cursor, bool next)
+{
+    int found = -1;
+    for(uint8_t i = 0; i < log->segment_count; i++)
+    {
+        if(next)
+        {
+            if(log->segments[i].seq > cursor->seq)
+            {
+                found = i;
+                break;
+            }
+        }
+        else if(log->segments[i].first_id <= cursor->last_id || found < 0)
+        {
+            found = i;
+        }
+    }
+    eventlog_cursor_close(cursor);
+    if(found < 0) return false;
+
+    char name[EVENTLOG_PATH_SIZE + 12];
+    segment_name(log, log->segments[found].seq, name, sizeof(name));
+    cursor->seq = log->segments[found].seq;
+    cursor->file = fopen(name, "r");
+    return cursor->file != NULL;
+}
+
+//@return ESP_ERR_TIMEOUT while the flush task holds file_lock, readers must not wait for flash writes
+static esp_err_t read_flash(eventlog_t* log, eventlog_cursor_t* cursor, char* buf, size_t size, size_t* len)
+{
+    size_t ret = 0;
+    record_t rec;
+
+    if(xSemaphoreTake(log->file_lock, 0) != pdTRUE) return ESP_ERR_TIMEOUT;
+    bool readable = log->opened && (cursor->file != NULL || cursor_open(log, cursor, false));
+    while(readable)
+    {
+        //Segments are only appended to, so data written after the last read becomes visible
+        clearerr(cursor->file);
+        if(fread(&rec, sizeof(rec), 1, cursor->file) != 1)
+        {
+            readable = cursor_open(log, cursor, true);
+            continue;
+        }
+        if(rec.id <= cursor->last_id || rec.len > size)
+        {
+            if(fseek(cursor->file, rec.len, SEEK_CUR)) readable = cursor_open(log, cursor, true);
+            continue;
+        }
+        if(fread(buf, 1, rec.len, cursor->file) != rec.len)
+        {
+            readable = cursor_open(log, cursor, true);
+            continue;
+        }
+        cursor->last_id = rec.id;
+        ret = rec.len;
+        break;
+    }
+
+    if(ret == 0)
+    {
+        //Everything after this point is still in RAM unless another batch gets flushed
+        eventlog_cursor_close(cursor);
+        portENTER_CRITICAL(&log->batch_mux);
+        cursor->flushed_id = log->flushed_id;
+        portEXIT_CRITICAL(&log->batch_mux);
+        cursor->in_ram = true;
+    }
+    xSemaphoreGive(log->file_lock);
+    *len = ret;
+    return ESP_OK;
+}
+
+static size_t read_ram(eventlog_t* log, eventlog_cursor_t* cursor, char* buf, size_t size)
+{
+    size_t ret = 0;
+    int id = cursor->last_id;
+    record_t rec;
+
+    portENTER_CRITICAL(&log->batch_mux);
+    bool flushed = (log->flushed_id != cursor->flushed_id);
+    //The batch that isn't active is older
+    uint8_t order[2] = { !log->active, log->active };
+    size_t lens[2] = { log->batch_len[order[0]], log->batch_len[order[1]] };
+    portEXIT_CRITICAL(&log->batch_mux);
+
+    for(uint8_t n = 0; n < 2 && ret == 0 && !flushed; n++)
+    {
+        uint8_t* batch = log->batch[order[n]];
+        for(size_t pos = 0; pos + sizeof(rec) <= lens[n]; pos += sizeof(rec) + rec.len)
+        {
+            memcpy(&rec, batch + pos, sizeof(rec));
+            //A batch flushed while scanning may be overwritten, checked below
+            if(pos + sizeof(rec) + rec.len > lens[n]) break;
+            if(rec.id <= cursor->last_id || rec.len > size) continue;
+            memcpy(buf, batch + pos + sizeof(rec), rec.len);
+            id = rec.id;
+            ret = rec.len;
+            break;
+        }
+    }
+
+    portENTER_CRITICAL(&log->batch_mux);
+    flushed = flushed || (log->flushed_id != cursor->flushed_id);
+    portEXIT_CRITICAL(&log->batch_mux);
+
+    if(flushed)
+    {
+        //Events moved to flash in the meantime
+        cursor->in_ram = false;
+        return 0;
+    }
+    cursor->last_id = id;
+    return ret;
+}
+
+/**
+ * Copies the next event after cursor->last_id to @param buf, first from flash then from the RAM batches
+ * @param len length of the event or 0 if the reader caught up with the log
+ * @return ESP_ERR_TIMEOUT if a segment is being written right now, try again later
+ */
+esp_err_t eventlog_read(eventlog_t* log, eventlog_cursor_t* cursor, char* buf, size_t size, size_t* len)
+{
+    *len = 0;
+    for(uint8_t attempt = 0; attempt < 2; attempt++)
+    {
+        if(!cursor->in_ram)
+        {
+            esp_err_t ret = read_flash(log, cursor, buf, size, len);
+            if(ret != ESP_OK || *len) return ret;
+        }
+        *len = read_ram(log, cursor, buf, size);
+        if(*len || cursor->in_ram) return ESP_OK;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,41 @@
+#ifndef NET_EVENTLOG_H
+#define NET_EVENTLOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "esp_system.h"
+
+/**
+ * Durable, append-only log of events on the storage partition
+ *
+ * Appending only copies the event into a RAM batch, a background task writes full batches
+ * (or whatever arrived within EVENTLOG_FLUSH_INTERVAL_ms) to the newest segment file.
+ * Segments are named <path>.<sequence number>, the oldest segment is deleted once the log
+ * exceeds its maximum number of segments.
+ * Events are ordered by their id, which has to increase.
+ */
+
+typedef struct eventlog eventlog_t;
+
+//Position of a reader in the log
+typedef struct {
+    int last_id;        //Last id returned to the reader
+    FILE* file;
+    uint32_t seq;       //Segment of file
+    bool in_ram;        //Flash is exhausted, the reader follows the RAM batches
+    int flushed_id;     //Last flushed id when flash was exhausted
+} eventlog_cursor_t;
+
+esp_err_t eventlog_init(eventlog_t** log, const char* path);
+void eventlog_deinit(eventlog_t* log);
+
+esp_err_t eventlog_append(eventlog_t* log, int id, const char* buf, size_t len);
+int eventlog_get_last_id(eventlog_t* log);
+unsigned int eventlog_get_dropped(eventlog_t* log);
+
+void eventlog_cursor_init(eventlog_cursor_t* cursor, int last_id);
+esp_err_t eventlog_read(eventlog_t* log, eventlog_cursor_t* cursor, char* buf, size_t size, size_t* len);
+void eventlog_cursor_close(eventlog_cursor_t* cursor);
+
+#endif
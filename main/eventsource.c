@@ -1,10 +1,14 @@
 #include "eventsource.h"
 
 #include <string.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <math.h>
 #include <sys/param.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
+#include "freertos/timers.h"
 #include "esp_system.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
@@ -12,6 +16,9 @@
 #include "nvs_flash.h"
 #include "tcpip_adapter.h"
 
+#include "mbedtls/sha1.h"
+#include "mbedtls/base64.h"
+
 #include "lwip/err.h"
 #include "lwip/sockets.h"
 #include "lwip/sys.h"
@@ -19,259 +26,1349 @@
 #include "errno.h"
 
 #include "defutil.h"
+#include "sse.h"
+#include "deflate.h"
+#include "eventlog.h"
+#include "sockbudget.h"
+#include "mempool.h"
+
+//Time a task waits for a free frame before the event is dropped
+#define EVENTSOURCE_PUBLISH_TIMEOUT_ms 100
+//Time eventsource_stop waits for the task to close all sockets
+#define EVENTSOURCE_STOP_TIMEOUT_ms 1000
+#define EVENTSOURCE_MAX_INSTANCES 4
+
+//Optional WebSocket transport carrying the same events downstream and API calls upstream
+#define EVENTSOURCE_WS_SUPPORT 1
+//Space in front of every frame for the largest WebSocket header the server sends
+#define EVENTSOURCE_WS_HEADROOM 4
+
+//Memory slot of every instance with CONFIG_WEBIF_STATIC_ALLOC, the default config needs about 15 kB,
+//compression adds 2 * compress_window per session and the event log another tx_size
+#define EVENTSOURCE_STATIC_INSTANCES 2
+#define EVENTSOURCE_STATIC_MEMSIZE 32768
+#define EVENTSOURCE_STATIC_TASK_STACK 4096
 
-#define EVENTSOURCE_RXSIZE 4096
-#define EVENTSOURCE_TXSIZE 1024
-#define EVENTSOURCE_MAXCON 5
-#define EVENTSOURCE_PORT 8080
+//Longest header value the server looks at, e.g. Accept-Encoding
+#define EVENTSOURCE_HDR_VALUE_SIZE 128
 
-#define EVENTSOURCE_ENDPOINT "GET /api.sse"
+//Logged events sent to a reconnected session per loop, so live sessions aren't held up by a long replay
+#define EVENTSOURCE_REPLAY_BATCH 4
+//Time until a replay continues while the log is written to flash
+#define EVENTSOURCE_REPLAY_RETRY_ms 10
+
+//Upper bound of rate_limit_types and longest event name that is rate limited
+#define EVENTSOURCE_RATE_MAX_TYPES 8
+#define EVENTSOURCE_RATE_NAME_SIZE 16
+//Longest interval a client can ask for, requests beyond it are ignored
+#define EVENTSOURCE_RATE_MAX_INTERVAL_ms 300000
+
+#define EVENTSOURCE_ALIGN(x) (((x) + 7) & ~(size_t)7)
 
 static const char* TAG = "NET/EventSource";
 
 //\r\nTransfer-Encoding: chunked  retry:5000\n
 static const char* resp_accept = "HTTP/1.1 200 OK\r\nConnection: keep-alive\r\nContent-Type: text/event-stream\r\nAccess-Control-Allow-Origin: *\r\nAccess-Control-Expose-Headers: *\r\n\r\n\r\n";
+static const char resp_accept_compressed[] = "HTTP/1.1 200 OK\r\nConnection: keep-alive\r\nContent-Type: text/event-stream\r\nContent-Encoding: %s\r\nAccess-Control-Allow-Origin: *\r\nAccess-Control-Expose-Headers: *\r\n\r\n";
+//Sent to clients that can't be admitted. EventSource reconnects on its own after Retry-After
+static const char resp_unavailable[] = "HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\nRetry-After: 5\r\nContent-Length: 0\r\nAccess-Control-Allow-Origin: *\r\n\r\n";
+
+typedef enum {
+    SESS_PENDING = 0,   //Connected, but no endpoint requested yet
+    SESS_SSE,
+    SESS_WS
+} sess_type_t;
+
+typedef struct {
+    int fd;
+    TickType_t opened;
+    sess_type_t type;
+    bool compressed;
+    deflate_t deflate;
+    //Catching up on the event log after Last-Event-ID, logged events are only sent from the log meanwhile
+    bool replaying;
+    eventlog_cursor_t cursor;
+    //Requested with ?maxrate or ?interval, 0 if unlimited. Events of a type that arrive before the
+    //next slot only mark the type as pending, the latest one is sent once the slot arrives
+    TickType_t min_interval;
+    uint8_t rate_pending;
+    TickType_t rate_sent[EVENTSOURCE_RATE_MAX_TYPES];
+    //Start of a WebSocket frame that didn't arrive completely yet, kept in ws_rx_mem
+    uint16_t ws_held;
+} sess_t;
+
+/**
+ * Outgoing events are written into frames from a fixed pool.
+ * Publishers take a frame from the free ring, fill it and push it to the pending ring.
+ * Only eventsource_task pops the pending ring and writes to the sockets,
+ * so publishing never touches a socket and works from any task or ISR.
+ */
+typedef struct {
+    int session;
+    int id;
+    size_t len;
+    bool data_line;
+    //WebSocket header is written in front of the event, see frame_buf. Followed by tx_size bytes
+    char mem[];
+} frame_t;
+
+static inline char* frame_buf(frame_t* frame)
+{
+    return frame->mem + EVENTSOURCE_WS_HEADROOM;
+}
+
+//Bounded lock-free MPMC ring of frame indices (Dmitry Vyukov's algorithm)
+typedef struct {
+    atomic_uint seq;
+    uint8_t frame;
+} ring_cell_t;
+
+typedef struct {
+    ring_cell_t* cells;
+    unsigned int mask;
+    atomic_uint head;
+    atomic_uint tail;
+} ring_t;
+
+struct eventsource {
+    eventsource_config_t config;
+
+    //All buffers live in one allocation right behind this struct, see instance_memsize
+    sess_t* sessions;
+    uint8_t* frames;
+    size_t frame_stride;
+    char* rx_buf;
+    //Incomplete WebSocket frames, ws_rx_size bytes per session
+    char* ws_rx_mem;
+    //Compression windows of all sessions and output of the session being written
+    uint8_t* deflate_mem;
+    uint8_t* deflate_buf;
+    //Events read from the log for replaying sessions
+    char* replay_buf;
+    eventlog_t* log;
+    //Latest broadcast of every event type, sent to rate limited sessions at their next slot
+    char* rate_buf;
+    size_t rate_len[EVENTSOURCE_RATE_MAX_TYPES];
+    char rate_names[EVENTSOURCE_RATE_MAX_TYPES][EVENTSOURCE_RATE_NAME_SIZE];
+    uint8_t rate_types;
+    uint8_t rate_sessions;
+
+    ring_t free_ring;
+    ring_t pending_ring;
+    atomic_uint dropped;
+
+    TaskHandle_t task_handle;
+    SemaphoreHandle_t stopped_sem;
+    int listen_sock;
+
+    //Loopback UDP socket connected to itself. A datagram wakes eventsource_task from select
+    int wake_sock;
+    atomic_flag wake_pending;
+
+    //Set when the socket budget asks to free a session for another server
+    atomic_bool evict_requested;
+    uint8_t sess_count;
+
+    volatile bool running;
+
+    eventsource_joined_cb_t joined_cb;
+    eventsource_message_cb_t message_cb;
+
+    mempool_stat_t frames_pool;
+    mempool_stat_t sessions_pool;
+    char frames_pool_name[24];
+    char sessions_pool_name[24];
+
+#if MEMPOOL_STATIC
+    StaticSemaphore_t stopped_sem_mem;
+    StaticTask_t task_mem;
+#endif
+};
+
+typedef struct eventsource eventsource_t;
+
+static eventsource_t* instances[EVENTSOURCE_MAX_INSTANCES];
+static portMUX_TYPE instances_mux = portMUX_INITIALIZER_UNLOCKED;
+
+#if MEMPOOL_STATIC
+static uint64_t instance_mem[EVENTSOURCE_STATIC_INSTANCES][EVENTSOURCE_STATIC_MEMSIZE / sizeof(uint64_t)];
+static StackType_t task_stacks[EVENTSOURCE_STATIC_INSTANCES][EVENTSOURCE_STATIC_TASK_STACK];
+static bool instance_used[EVENTSOURCE_STATIC_INSTANCES];
+#endif
+
+static esp_err_t sess_write(eventsource_t* es, int i, const char* buf, size_t len);
+static void sess_close(eventsource_t* es, int i);
+
+static void sess_join(eventsource_t* es, int i, sess_type_t type)
+{
+    es->sessions[i].type = type;
+    //Invoke join callback after client was accepted
+    if(es->joined_cb != NULL) es->joined_cb(es, i);
+}
+
+//Matches the request line "GET <path>" followed by a query or the protocol version
+static bool request_matches(const char* req, const char* path)
+{
+    if(path == NULL || !STARTS_WITH(req, "GET ")) return false;
+    req += 4;
+    size_t len = strlen(path);
+    if(strncmp(req, path, len)) return false;
+    return req[len] == ' ' || req[len] == '?';
+}
+
+/**
+ * Finds parameter @param key in the query of the request line in @param req
+ * @return length of the value copied to @param value or 0 if not found
+ */
+static size_t request_query_value(const char* req, const char* key, char* value, size_t size)
+{
+    const char* end = strchr(req + 4, ' ');
+    if(end == NULL) return 0;
+    const char* param = memchr(req, '?', end - req);
+    if(param == NULL) return 0;
 
-static int conns[EVENTSOURCE_MAXCON];
-static int listen_sock = -1;
+    size_t key_len = strlen(key);
+    while(param++ < end)
+    {
+        const char* param_end = memchr(param, '&', end - param);
+        if(param_end == NULL) param_end = end;
+        if(param_end - param > key_len && !strncmp(param, key, key_len) && param[key_len] == '=')
+        {
+            size_t len = param_end - param - key_len - 1;
+            if(len >= size) return 0;
+            memcpy(value, param + key_len + 1, len);
+            value[len] = 0;
+            return len;
+        }
+        param = param_end;
+    }
+    return 0;
+}
 
-static char* rx_buf = NULL;
-static char* tx_buf = NULL;
+/**
+ * Finds the value of header @param name in the NUL terminated request in rx_buf
+ * @return length of the value copied to @param value or 0 if not found
+ */
+static size_t http_header_value(eventsource_t* es, const char* name, char* value, size_t size)
+{
+    size_t name_len = strlen(name);
+    const char* line = strstr(es->rx_buf, "\r\n");
+    while(line != NULL)
+    {
+        line += 2;
+        if(!strncasecmp(line, name, name_len) && line[name_len] == ':')
+        {
+            const char* start = line + name_len + 1;
+            while(*start == ' ') start++;
+            const char* end = strstr(start, "\r\n");
+            if(end == NULL) return 0;
+            while(end > start && end[-1] == ' ') end--;
+            size_t len = end - start;
+            if(len >= size) return 0;
+            memcpy(value, start, len);
+            value[len] = 0;
+            return len;
+        }
+        line = strstr(line, "\r\n");
+    }
+    return 0;
+}
 
-static bool running = false;
+#if EVENTSOURCE_WS_SUPPORT
 
-static SemaphoreHandle_t x_mutex = NULL;
+#define WS_OP_CONT 0x0
+#define WS_OP_TEXT 0x1
+#define WS_OP_BINARY 0x2
+#define WS_OP_CLOSE 0x8
+#define WS_OP_PING 0x9
+#define WS_OP_PONG 0xA
 
-static eventsource_joined_cb_t joined_cb = NULL;
+#define WS_KEY_MAXLEN 32
 
-static esp_err_t sess_write(int i, const char* buf, size_t len);
+static const char ws_guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
 
-static void sess_recv(int i, size_t len)
+static void ws_handshake(eventsource_t* es, int i)
 {
-    if(i>=EVENTSOURCE_MAXCON) return;
-    if(len < strlen(EVENTSOURCE_ENDPOINT)) return;
-    if(STARTS_WITH(rx_buf, EVENTSOURCE_ENDPOINT))
+    char key[WS_KEY_MAXLEN + sizeof(ws_guid)];
+    size_t key_len = http_header_value(es, "Sec-WebSocket-Key", key, WS_KEY_MAXLEN);
+    if(key_len == 0)
     {
-        sess_write(i, resp_accept, strlen(resp_accept));
-        //Invoke join callback after client was accepted
-        if(joined_cb != NULL) joined_cb(i);
+        ESP_LOGE(es->config.name, "WebSocket request without key. Closing...");
+        sess_close(es, i);
+        return;
     }
+    memcpy(key + key_len, ws_guid, sizeof(ws_guid) - 1);
+
+    unsigned char sha1[20];
+    unsigned char accept_key[32];
+    size_t accept_len = 0;
+    mbedtls_sha1_ret((unsigned char*)key, key_len + sizeof(ws_guid) - 1, sha1);
+    mbedtls_base64_encode(accept_key, sizeof(accept_key), &accept_len, sha1, sizeof(sha1));
+
+    char resp[160];
+    int resp_len = snprintf(resp, sizeof(resp),
+            "HTTP/1.1 101 Switching Protocols\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Accept: %.*s\r\n\r\n", (int)accept_len, accept_key);
+    if(sess_write(es, i, resp, resp_len) != ESP_OK) return;
+
+    ESP_LOGI(es->config.name, "Session %d upgraded to WebSocket", i);
+    sess_join(es, i, SESS_WS);
 }
 
-static int sess_available(void)
+/**
+ * Writes the header of an unmasked, unfragmented server frame right before @param payload
+ * @return header length
+ */
+static size_t ws_frame_header(char* payload, uint8_t opcode, size_t len)
 {
-    for(uint8_t i = 0; i < EVENTSOURCE_MAXCON; i++)
+    if(len < 126)
     {
-        if(conns[i] == -1) return i;
+        payload[-2] = 0x80 | opcode;
+        payload[-1] = len;
+        return 2;
+    }
+    payload[-4] = 0x80 | opcode;
+    payload[-3] = 126;
+    payload[-2] = (len >> 8) & 0xFF;
+    payload[-1] = len & 0xFF;
+    return 4;
+}
+
+static void ws_send_control(eventsource_t* es, int i, uint8_t opcode, const char* payload, size_t len)
+{
+    char frame[2 + 125];
+    if(len > 125) len = 125;
+    memcpy(frame + 2, payload, len);
+    ws_frame_header(frame + 2, opcode, len);
+    sess_write(es, i, frame, len + 2);
+}
+
+//Moves the held start of a split frame of session @param i to the front of rx_buf, the next read continues behind it
+static size_t ws_restore(eventsource_t* es, int i)
+{
+    sess_t* sess = &es->sessions[i];
+    size_t len = sess->ws_held;
+    if(sess->type != SESS_WS || len == 0) return 0;
+    memcpy(es->rx_buf, es->ws_rx_mem + i * es->config.ws_rx_size, len);
+    sess->ws_held = 0;
+    return len;
+}
+
+//Parses all client frames in rx_buf, an incomplete frame at the end is held until the next read
+static void ws_recv(eventsource_t* es, int i, size_t len)
+{
+    uint8_t* pos = (uint8_t*)es->rx_buf;
+    uint8_t* end = pos + len;
+    uint8_t* frame;
+    size_t max_len = es->config.ws_rx_size;
+
+    while(pos < end)
+    {
+        frame = pos;
+        if(end - pos < 2) goto incomplete;
+        bool fin = pos[0] & 0x80;
+        uint8_t opcode = pos[0] & 0x0F;
+        bool masked = pos[1] & 0x80;
+        size_t payload_len = pos[1] & 0x7F;
+        pos += 2;
+
+        if(payload_len == 126)
+        {
+            if(end - pos < 2) goto incomplete;
+            payload_len = (pos[0] << 8) | pos[1];
+            pos += 2;
+        }
+        else if(payload_len == 127)
+        {
+            //Larger than ws_rx_size anyway
+            goto oversized;
+        }
+
+        if(!masked)
+        {
+            ESP_LOGE(es->config.name, "Unmasked WebSocket frame from client. Closing...");
+            goto close;
+        }
+        if((pos - frame) + 4 + payload_len > max_len) goto oversized;
+        if(end - pos < 4 + payload_len) goto incomplete;
+        uint8_t* mask = pos;
+        uint8_t* payload = pos + 4;
+        for(size_t n = 0; n < payload_len; n++)
+        {
+            payload[n] ^= mask[n & 3];
+        }
+        pos = payload + payload_len;
+
+        if(!fin || opcode == WS_OP_CONT)
+        {
+            ESP_LOGE(es->config.name, "Fragmented WebSocket messages are not supported. Closing...");
+            goto close;
+        }
+
+        switch(opcode)
+        {
+        case WS_OP_TEXT:
+        case WS_OP_BINARY:
+            if(es->message_cb != NULL)
+            {
+                //Terminate the message in place. The byte after it belongs to the next frame
+                //or is the spare byte at the end of rx_buf
+                uint8_t next = payload[payload_len];
+                payload[payload_len] = 0;
+                es->message_cb(es, i, (const char*)payload);
+                payload[payload_len] = next;
+            }
+            break;
+        case WS_OP_PING:
+            ws_send_control(es, i, WS_OP_PONG, (const char*)payload, payload_len);
+            break;
+        case WS_OP_PONG:
+            break;
+        case WS_OP_CLOSE:
+            ws_send_control(es, i, WS_OP_CLOSE, (const char*)payload, MIN(payload_len, 2));
+            sess_close(es, i);
+            return;
+        default:
+            goto close;
+        }
+        //The callback may have closed the session
+        if(es->sessions[i].fd < 0) return;
+    }
+    return;
+
+    incomplete:
+    //Frames are at most ws_rx_size bytes, checked above as soon as the length is known
+    es->sessions[i].ws_held = end - frame;
+    memcpy(es->ws_rx_mem + i * max_len, frame, end - frame);
+    return;
+
+    oversized:
+    ESP_LOGE(es->config.name, "WebSocket frame larger than ws_rx_size. Closing...");
+    ws_send_control(es, i, WS_OP_CLOSE, "\x03\xF1", 2); //1009 message too big
+    sess_close(es, i);
+    return;
+
+    close:
+    ws_send_control(es, i, WS_OP_CLOSE, "\x03\xF0", 2); //1008 policy violation
+    sess_close(es, i);
+}
+
+#endif
+
+static void sse_handshake(eventsource_t* es, int i)
+{
+    sess_t* sess = &es->sessions[i];
+    size_t window = es->config.compress_window;
+    char encodings[EVENTSOURCE_HDR_VALUE_SIZE];
+    const char* encoding = NULL;
+    deflate_format_t format = DEFLATE_FORMAT_ZLIB;
+
+    sess->compressed = false;
+    if(window && http_header_value(es, "Accept-Encoding", encodings, sizeof(encodings)))
+    {
+        if(strstr(encodings, "gzip") != NULL)
+        {
+            encoding = "gzip";
+            format = DEFLATE_FORMAT_GZIP;
+        }
+        else if(strstr(encodings, "deflate") != NULL)
+        {
+            encoding = "deflate";
+        }
+    }
+
+    if(encoding == NULL)
+    {
+        if(sess_write(es, i, resp_accept, strlen(resp_accept)) != ESP_OK) return;
+    }
+    else
+    {
+        char resp[sizeof(resp_accept_compressed) + 8];
+        int resp_len = snprintf(resp, sizeof(resp), resp_accept_compressed, encoding);
+        if(sess_write(es, i, resp, resp_len) != ESP_OK) return;
+        deflate_init(&sess->deflate, format, es->deflate_mem + i * DEFLATE_MEMSIZE(window), window);
+        sess->compressed = true;
+    }
+
+    //Clients on slow links ask for at most maxrate events per second or one event per interval ms of every type
+    char value[12];
+    char* end = value;
+    uint32_t interval_ms = 0;
+    if(request_query_value(es->rx_buf, "maxrate", value, sizeof(value)))
+    {
+        float rate = strtof(value, &end);
+        //Rates above 1000 events per second are no limit
+        if(end != value && *end == 0 && isfinite(rate) && rate >= 1000.0f / EVENTSOURCE_RATE_MAX_INTERVAL_ms)
+        {
+            interval_ms = MIN((uint32_t)(1000.0f / rate), EVENTSOURCE_RATE_MAX_INTERVAL_ms);
+        }
+        else
+        {
+            ESP_LOGW(es->config.name, "Session %d: ignoring maxrate=%s", i, value);
+        }
+    }
+    else if(request_query_value(es->rx_buf, "interval", value, sizeof(value)))
+    {
+        unsigned long interval = strtoul(value, &end, 10);
+        if(end != value && *end == 0 && value[0] != '-' && interval <= EVENTSOURCE_RATE_MAX_INTERVAL_ms)
+        {
+            interval_ms = interval;
+        }
+        else
+        {
+            ESP_LOGW(es->config.name, "Session %d: ignoring interval=%s", i, value);
+        }
+    }
+    if(interval_ms && es->rate_buf != NULL)
+    {
+        sess->min_interval = MAX(interval_ms/portTICK_PERIOD_MS, 1);
+        TickType_t now = xTaskGetTickCount();
+        for(uint8_t t = 0; t < EVENTSOURCE_RATE_MAX_TYPES; t++)
+        {
+            sess->rate_sent[t] = now - sess->min_interval;
+        }
+        es->rate_sessions++;
+        ESP_LOGI(es->config.name, "Session %d limited to one event per %u ms and type", i, (unsigned)interval_ms);
+    }
+
+    //Sent by EventSource when reconnecting, the missed events are streamed from the log
+    char last_id[12];
+    if(es->log != NULL && http_header_value(es, "Last-Event-ID", last_id, sizeof(last_id)))
+    {
+        eventlog_cursor_init(&sess->cursor, atoi(last_id));
+        sess->replaying = true;
+        ESP_LOGI(es->config.name, "Session %d replays events after %s", i, last_id);
+    }
+    sess_join(es, i, SESS_SSE);
+}
+
+static void sess_recv(eventsource_t* es, int i, size_t len)
+{
+    if(i>=es->config.max_sessions) return;
+
+#if EVENTSOURCE_WS_SUPPORT
+    if(es->sessions[i].type == SESS_WS)
+    {
+        ws_recv(es, i, len);
+        return;
+    }
+#endif
+    if(es->sessions[i].type != SESS_PENDING) return;
+
+    //rx_buf always has room for the terminator, see eventsource_task
+    es->rx_buf[len] = 0;
+
+    if(request_matches(es->rx_buf, es->config.endpoint))
+    {
+        sse_handshake(es, i);
+    }
+#if EVENTSOURCE_WS_SUPPORT
+    else if(request_matches(es->rx_buf, es->config.ws_endpoint))
+    {
+        ws_handshake(es, i);
+    }
+#endif
+}
+
+static int sess_available(eventsource_t* es)
+{
+    for(uint8_t i = 0; i < es->config.max_sessions; i++)
+    {
+        if(es->sessions[i].fd == -1) return i;
     }
     return -1;
 }
 
-static int sess_accept(void)
+/**
+ * Picks the session to close in favor of a new one
+ * @param idle_only only consider sessions that never requested the endpoint
+ * @return oldest matching session or -1
+ */
+static int sess_pick_victim(eventsource_t* es, bool idle_only)
 {
-    int i = sess_available();
-    if (i < 0)
+    TickType_t now = xTaskGetTickCount();
+    int victim = -1;
+    for(uint8_t i = 0; i < es->config.max_sessions; i++)
     {
-        return -1;
+        sess_t* sess = &es->sessions[i];
+        if(sess->fd <= 0 || (idle_only && sess->type != SESS_PENDING)) continue;
+        if(victim < 0 || (now - sess->opened) > (now - es->sessions[victim].opened)) victim = i;
     }
+    return victim;
+}
+
+//Answers with a pre-built 503 and closes the connection, so clients don't hang in the backlog
+static void sess_reject(eventsource_t* es, int fd)
+{
+    send(fd, resp_unavailable, sizeof(resp_unavailable) - 1, MSG_DONTWAIT);
+    shutdown(fd, SHUT_WR);
+    close(fd);
+    ESP_LOGW(es->config.name, "Rejected connection, no session available");
+}
 
-    int fd = accept(listen_sock, NULL, NULL);
+static int sess_accept(eventsource_t* es)
+{
+    //Always accept, otherwise the listening socket stays readable and select returns immediately
+    int fd = accept(es->listen_sock, NULL, NULL);
     if(fd < 0)
     {
-        ESP_LOGE(TAG, "Failed to accept: %d", errno);
+        ESP_LOGE(es->config.name, "Failed to accept: %d", errno);
         return -1;
     }
-    conns[i] = fd;
-    ESP_LOGI(TAG, "Opened session %d", i);
+
+    eventsource_admission_t admission = es->config.admission;
+    int i = sess_available(es);
+    if(i < 0 && admission != EVENTSOURCE_ADMIT_REJECT)
+    {
+        int victim = sess_pick_victim(es, true);
+        if(victim < 0 && admission == EVENTSOURCE_ADMIT_EVICT_OLDEST) victim = sess_pick_victim(es, false);
+        if(victim >= 0)
+        {
+            ESP_LOGI(es->config.name, "Evicting session %d in favor of new connection", victim);
+            sess_close(es, victim);
+            i = victim;
+        }
+    }
+
+    if(i < 0 || sockbudget_acquire(SOCKBUDGET_SSE) != ESP_OK)
+    {
+        sess_reject(es, fd);
+        return -1;
+    }
+
+    sess_t* sess = &es->sessions[i];
+    sess->fd = fd;
+    sess->opened = xTaskGetTickCount();
+    sess->type = SESS_PENDING;
+    sess->compressed = false;
+    sess->replaying = false;
+    sess->min_interval = 0;
+    sess->rate_pending = 0;
+    sess->ws_held = 0;
+    es->sess_count++;
+    mempool_take(&es->sessions_pool);
+    ESP_LOGI(es->config.name, "Opened session %d", i);
     return i;
 }
 
-static void sess_close(int i)
+static void sess_close(eventsource_t* es, int i)
 {
-    if(i>=EVENTSOURCE_MAXCON) return;
-    int fd = conns[i];
-    if(fd>0) close(fd);
-    conns[i] = -1;
-    ESP_LOGI(TAG, "Closed session %d", i);
+    if(i>=es->config.max_sessions) return;
+    int fd = es->sessions[i].fd;
+    if(fd>0)
+    {
+        close(fd);
+        sockbudget_release(SOCKBUDGET_SSE);
+        es->sess_count--;
+        mempool_give(&es->sessions_pool);
+    }
+    if(es->sessions[i].replaying) eventlog_cursor_close(&es->sessions[i].cursor);
+    es->sessions[i].replaying = false;
+    if(es->sessions[i].min_interval) es->rate_sessions--;
+    es->sessions[i].min_interval = 0;
+    es->sessions[i].rate_pending = 0;
+    es->sessions[i].ws_held = 0;
+    es->sessions[i].fd = -1;
+    ESP_LOGI(es->config.name, "Closed session %d", i);
 }
 
-static esp_err_t sess_write(int i, const char* buf, size_t len)
+static esp_err_t sess_write(eventsource_t* es, int i, const char* buf, size_t len)
 {
-    if(i>=EVENTSOURCE_MAXCON) return ESP_FAIL;
-    int fd = conns[i];
+    if(i>=es->config.max_sessions) return ESP_FAIL;
+    int fd = es->sessions[i].fd;
     if(fd < 0) return ESP_OK;
     if(write(fd, buf, len) < 0)
     {
-        ESP_LOGE(TAG, "Failed writing to socket. Closing...");
-        sess_close(i);
+        ESP_LOGE(es->config.name, "Failed writing to socket. Closing...");
+        sess_close(es, i);
         return ESP_FAIL;
     }
     return ESP_OK;
 }
 
-//Task running all TCP networking
+static void ring_init(ring_t* ring, ring_cell_t* cells, unsigned int len)
+{
+    ring->cells = cells;
+    ring->mask = len - 1;
+    for(unsigned int i = 0; i < len; i++)
+    {
+        atomic_init(&ring->cells[i].seq, i);
+        ring->cells[i].frame = 0;
+    }
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+}
+
+static bool ring_push(ring_t* ring, uint8_t frame)
+{
+    unsigned int pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ring_cell_t* cell;
+    while(true)
+    {
+        cell = &ring->cells[pos & ring->mask];
+        unsigned int seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        int dif = (int)(seq - pos);
+        if(dif == 0)
+        {
+            if(atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) break;
+        }
+        else if(dif < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+    cell->frame = frame;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    return true;
+}
+
+static bool ring_pop(ring_t* ring, uint8_t* frame)
+{
+    unsigned int pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    ring_cell_t* cell;
+    while(true)
+    {
+        cell = &ring->cells[pos & ring->mask];
+        unsigned int seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        int dif = (int)(seq - (pos + 1));
+        if(dif == 0)
+        {
+            if(atomic_compare_exchange_weak_explicit(&ring->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) break;
+        }
+        else if(dif < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+    *frame = cell->frame;
+    atomic_store_explicit(&cell->seq, pos + ring->mask + 1, memory_order_release);
+    return true;
+}
+
+static inline frame_t* frame_at(eventsource_t* es, uint8_t i)
+{
+    return (frame_t*)(es->frames + i * es->frame_stride);
+}
+
+static bool frame_alloc(eventsource_t* es, uint8_t* frame)
+{
+    if(!ring_pop(&es->free_ring, frame)) return false;
+    mempool_take(&es->frames_pool);
+    return true;
+}
+
+static void frame_free(eventsource_t* es, uint8_t frame)
+{
+    mempool_give(&es->frames_pool);
+    ring_push(&es->free_ring, frame);
+}
+
+static esp_err_t wake_open(eventsource_t* es)
+{
+    es->wake_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(es->wake_sock < 0) return ESP_FAIL;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_family = AF_INET;
+    addr.sin_port = 0;
+    socklen_t addr_len = sizeof(addr);
+
+    //Bind to an ephemeral port and connect the socket to itself
+    if(bind(es->wake_sock, (struct sockaddr*)&addr, sizeof(addr))) return ESP_FAIL;
+    if(getsockname(es->wake_sock, (struct sockaddr*)&addr, &addr_len)) return ESP_FAIL;
+    if(connect(es->wake_sock, (struct sockaddr*)&addr, sizeof(addr))) return ESP_FAIL;
+    if(fcntl(es->wake_sock, F_SETFL, O_NONBLOCK)) return ESP_FAIL;
+
+    atomic_flag_clear(&es->wake_pending);
+    return ESP_OK;
+}
+
+static void wake_close(eventsource_t* es)
+{
+    if(es->wake_sock >= 0) close(es->wake_sock);
+    es->wake_sock = -1;
+}
+
+static void wake_send(eventsource_t* es)
+{
+    int fd = es->wake_sock;
+    //Without a datagram in flight the next signal has to try again
+    if(fd < 0 || send(fd, "", 1, 0) < 0) atomic_flag_clear(&es->wake_pending);
+}
+
+static void wake_send_deferred(void* param1, uint32_t param2)
+{
+    wake_send((eventsource_t*)param1);
+}
+
+//Wakes eventsource_task. Multiple signals before the task runs are coalesced into one datagram
+static void wake_signal(eventsource_t* es)
+{
+    if(atomic_flag_test_and_set(&es->wake_pending)) return;
+    wake_send(es);
+}
+
+//Sockets can't be used from an ISR, so the datagram is sent by the timer task instead
+static void wake_signal_from_isr(eventsource_t* es)
+{
+    if(atomic_flag_test_and_set(&es->wake_pending)) return;
+    BaseType_t woken = pdFALSE;
+    if(xTimerPendFunctionCallFromISR(wake_send_deferred, es, 0, &woken) != pdPASS)
+    {
+        atomic_flag_clear(&es->wake_pending);
+    }
+    if(woken) portYIELD_FROM_ISR();
+}
+
+/**
+ * Consumes all wakeup datagrams. Must only be called by eventsource_task before frames_drain
+ * The flag is cleared after draining, a signal that was skipped meanwhile is covered by the following frames_drain
+ */
+static void wake_consume(eventsource_t* es)
+{
+    char dummy[8];
+    while(recv(es->wake_sock, dummy, sizeof(dummy), 0) > 0);
+    atomic_flag_clear(&es->wake_pending);
+}
+
+//Called by the socket budget from any task, a session of the busiest instance is closed by its task
+static esp_err_t sess_evict_request(void)
+{
+    eventsource_t* victim = NULL;
+    portENTER_CRITICAL(&instances_mux);
+    for(uint8_t i = 0; i < EVENTSOURCE_MAX_INSTANCES; i++)
+    {
+        eventsource_t* es = instances[i];
+        if(es == NULL || !es->running || es->sess_count == 0) continue;
+        if(victim == NULL || es->sess_count > victim->sess_count) victim = es;
+    }
+    portEXIT_CRITICAL(&instances_mux);
+
+    if(victim == NULL) return ESP_FAIL;
+    atomic_store(&victim->evict_requested, true);
+    wake_signal(victim);
+    return ESP_OK;
+}
+
+//Closes the oldest session. Must only be called by eventsource_task
+static void sess_evict_oldest(eventsource_t* es)
+{
+    //Prefer connections that never became a stream
+    int victim = sess_pick_victim(es, true);
+    if(victim < 0) victim = sess_pick_victim(es, false);
+    if(victim < 0) return;
+    ESP_LOGI(es->config.name, "Evicting session %d", victim);
+    sess_close(es, victim);
+}
+
+static void sse_send(eventsource_t* es, int s, const char* buf, size_t len)
+{
+    sess_t* sess = &es->sessions[s];
+    if(sess->compressed)
+    {
+        //Every event ends with a sync flush, so it is delivered right away
+        size_t out_len = deflate_write(&sess->deflate, buf, len, es->deflate_buf);
+        sess_write(es, s, (const char*)es->deflate_buf, out_len);
+    }
+    else
+    {
+        sess_write(es, s, buf, len);
+    }
+}
+
+//Takes the slot of a rate limited session for an event of @param type if it is due
+static bool rate_take_slot(sess_t* sess, int type, TickType_t now)
+{
+    if(now - sess->rate_sent[type] < sess->min_interval) return false;
+    sess->rate_sent[type] = now;
+    sess->rate_pending &= ~(1 << type);
+    return true;
+}
+
+/**
+ * Sends a frame to session @param s
+ * @param logged the event has an id and went to the log, replaying sessions only receive it from there
+ * @param type rate limit type of the event or -1 if it is sent regardless of rate limits
+ */
+static void frame_send(eventsource_t* es, int s, frame_t* frame, size_t ws_header_len, bool logged, int type)
+{
+    sess_t* sess = &es->sessions[s];
+    if(sess->fd <= 0) return;
+    //The session gets this event from the log once it caught up
+    if(logged && sess->replaying) return;
+
+    char* buf = frame_buf(frame);
+    if(sess->type == SESS_SSE)
+    {
+        if(type >= 0 && sess->min_interval && !rate_take_slot(sess, type, xTaskGetTickCount()))
+        {
+            sess->rate_pending |= 1 << type;
+            return;
+        }
+        sse_send(es, s, buf, frame->len);
+    }
+    else if(sess->type == SESS_WS)
+    {
+        //Every event is sent as one text message in the same format as on the SSE stream
+        sess_write(es, s, buf - ws_header_len, frame->len + ws_header_len);
+    }
+}
+
+//Name of the event in the header of a frame, events without event line have an empty name
+static size_t frame_event_name(frame_t* frame, const char** name)
+{
+    const char* buf = frame_buf(frame);
+    const char* end = buf + frame->len;
+    if(end - buf > 4 && !strncmp(buf, "id: ", 4))
+    {
+        buf = memchr(buf, '\n', end - buf);
+        if(buf == NULL) return 0;
+        buf++;
+    }
+    *name = buf;
+    if(end - buf < 7 || strncmp(buf, "event: ", 7)) return 0;
+    buf += 7;
+    const char* eol = memchr(buf, '\n', end - buf);
+    *name = buf;
+    return (eol != NULL) ? eol - buf : 0;
+}
+
+/**
+ * Keeps a copy of a broadcast frame as the latest event of its type for rate limited sessions
+ * @return rate limit type of the frame or -1 if it isn't rate limited
+ */
+static int rate_track(eventsource_t* es, frame_t* frame)
+{
+    if(es->rate_sessions == 0) return -1;
+
+    const char* name;
+    size_t len = frame_event_name(frame, &name);
+    if(len >= EVENTSOURCE_RATE_NAME_SIZE) return -1;
+
+    int type = -1;
+    for(uint8_t t = 0; t < es->rate_types; t++)
+    {
+        if(!strncmp(es->rate_names[t], name, len) && es->rate_names[t][len] == 0)
+        {
+            type = t;
+            break;
+        }
+    }
+    if(type < 0)
+    {
+        //Types beyond rate_limit_types are never limited
+        if(es->rate_types == es->config.rate_limit_types) return -1;
+        type = es->rate_types++;
+        memcpy(es->rate_names[type], name, len);
+        es->rate_names[type][len] = 0;
+    }
+
+    memcpy(es->rate_buf + type * es->config.tx_size, frame_buf(frame), frame->len);
+    es->rate_len[type] = frame->len;
+    return type;
+}
+
+/**
+ * Sends the latest event of every pending type to rate limited sessions whose slot arrived. Must only be called by eventsource_task
+ * @return ticks until the next slot or portMAX_DELAY if nothing is pending
+ */
+static TickType_t sessions_rate_flush(eventsource_t* es)
+{
+    TickType_t now = xTaskGetTickCount();
+    TickType_t next = portMAX_DELAY;
+    for(uint8_t s = 0; s < es->config.max_sessions; s++)
+    {
+        sess_t* sess = &es->sessions[s];
+        for(uint8_t t = 0; t < es->rate_types && sess->fd > 0 && sess->rate_pending; t++)
+        {
+            if(!(sess->rate_pending & (1 << t))) continue;
+            if(rate_take_slot(sess, t, now))
+            {
+                sse_send(es, s, es->rate_buf + t * es->config.tx_size, es->rate_len[t]);
+            }
+            else
+            {
+                next = MIN(next, sess->min_interval - (now - sess->rate_sent[t]));
+            }
+        }
+    }
+    return next;
+}
+
+//Writes all pending frames to their sessions. Must only be called by eventsource_task
+static void frames_drain(eventsource_t* es)
+{
+    uint8_t i;
+    while(ring_pop(&es->pending_ring, &i))
+    {
+        frame_t* frame = frame_at(es, i);
+        size_t ws_header_len = 0;
+#if EVENTSOURCE_WS_SUPPORT
+        ws_header_len = ws_frame_header(frame_buf(frame), WS_OP_TEXT, frame->len);
+#endif
+        if(frame->session == EVENTSOURCE_SESSION_ALL)
+        {
+            //Events with an id are logged before they go out, so a replay can't miss them.
+            //One the log dropped is also skipped for replaying sessions, they see exactly the log in id order
+            bool logged = es->log != NULL && frame->id >= 0;
+            if(logged) eventlog_append(es->log, frame->id, frame_buf(frame), frame->len);
+            int type = rate_track(es, frame);
+            for(uint8_t s = 0; s < es->config.max_sessions; s++)
+            {
+                frame_send(es, s, frame, ws_header_len, logged, type);
+            }
+        }
+        else
+        {
+            frame_send(es, frame->session, frame, ws_header_len, false, -1);
+        }
+        frame_free(es, i);
+    }
+}
+
+/**
+ * Sends the next few logged events to every replaying session. Must only be called by eventsource_task
+ * @return ticks until the replay continues, 0 if it can go on right away or portMAX_DELAY if no session replays
+ */
+static TickType_t sessions_replay(eventsource_t* es)
+{
+    TickType_t next = portMAX_DELAY;
+    for(uint8_t s = 0; s < es->config.max_sessions; s++)
+    {
+        sess_t* sess = &es->sessions[s];
+        bool busy = false;
+        for(uint8_t n = 0; n < EVENTSOURCE_REPLAY_BATCH && sess->fd > 0 && sess->replaying; n++)
+        {
+            size_t len;
+            if(eventlog_read(es->log, &sess->cursor, es->replay_buf, es->config.tx_size, &len) != ESP_OK)
+            {
+                //Polling would keep the lower priority flush task from finishing, sleep instead
+                busy = true;
+                break;
+            }
+            if(len == 0)
+            {
+                //Caught up, following events are sent live by frames_drain
+                eventlog_cursor_close(&sess->cursor);
+                sess->replaying = false;
+                ESP_LOGI(es->config.name, "Session %d caught up at id %d", s, sess->cursor.last_id);
+                break;
+            }
+            sse_send(es, s, es->replay_buf, len);
+        }
+        if(sess->fd > 0 && sess->replaying)
+        {
+            next = MIN(next, busy ? MAX(EVENTSOURCE_REPLAY_RETRY_ms/portTICK_PERIOD_MS, 1) : 0);
+        }
+    }
+    return next;
+}
+
+//Task running all TCP networking of one instance
 static void eventsource_task(void* param)
 {
-    memset(conns, -1, EVENTSOURCE_MAXCON*sizeof(int));
+    eventsource_t* es = (eventsource_t*)param;
+    const char* tag = es->config.name;
+
+    for(uint8_t i = 0; i < es->config.max_sessions; i++)
+    {
+        es->sessions[i].fd = -1;
+    }
+    es->sess_count = 0;
 
-    ESP_LOGI(TAG, "Starting HTML5 EventSource...");
+    ESP_LOGI(tag, "Starting HTML5 EventSource...");
 
-    listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
-    if(listen_sock < 0) {
-        ESP_LOGE(TAG, "Failed to create socket");
+    es->listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if(es->listen_sock < 0) {
+        ESP_LOGE(tag, "Failed to create socket");
         goto fail;
     }
-    ESP_LOGI(TAG,"Socket created");
+    ESP_LOGI(tag,"Socket created");
     int err = 0;
 
     int en_int = 1;
-    err = setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &en_int, sizeof(en_int));
+    err = setsockopt(es->listen_sock, SOL_SOCKET, SO_REUSEADDR, &en_int, sizeof(en_int));
     if(err)
     {
-        ESP_LOGE(TAG, "Failed to set REUSEADDR");
+        ESP_LOGE(tag, "Failed to set REUSEADDR");
         goto fail;
     }
-    ESP_LOGI(TAG,"Configured socket");
+    ESP_LOGI(tag,"Configured socket");
 
     struct sockaddr_in dest_addr;
     dest_addr.sin_addr.s_addr = htonl(INADDR_ANY);
     dest_addr.sin_family = AF_INET;
-    dest_addr.sin_port = htons(EVENTSOURCE_PORT);
+    dest_addr.sin_port = htons(es->config.port);
 
-    err = bind(listen_sock, (struct sockaddr*)&dest_addr, sizeof(struct sockaddr));
+    err = bind(es->listen_sock, (struct sockaddr*)&dest_addr, sizeof(struct sockaddr));
     if(err)
     {
-        ESP_LOGE(TAG, "Failed to bind socket");
+        ESP_LOGE(tag, "Failed to bind socket");
         goto fail;
     }
-    ESP_LOGI(TAG, "Bound to PORT %d", EVENTSOURCE_PORT);
-    err = listen(listen_sock, 1);
+    ESP_LOGI(tag, "Bound to PORT %d", es->config.port);
+    err = listen(es->listen_sock, es->config.backlog);
     if(err)
     {
-        ESP_LOGE(TAG, "Failed to start listening for connections!");
+        ESP_LOGE(tag, "Failed to start listening for connections!");
+        goto fail;
+    }
+    ESP_LOGI(tag, "Listening for connections...");
+
+    if(wake_open(es) != ESP_OK)
+    {
+        ESP_LOGE(tag, "Failed to create wakeup socket!");
         goto fail;
     }
-    ESP_LOGI(TAG, "Listening for connections...");
 
     fd_set in_set;
     int max_fd;
+    TickType_t replay_wait = portMAX_DELAY;
+    TickType_t rate_wait = portMAX_DELAY;
 
-    while(running)
+    while(es->running)
     {
         FD_ZERO(&in_set);
-        FD_SET(listen_sock, &in_set);
-        max_fd = listen_sock;
+        FD_SET(es->listen_sock, &in_set);
+        FD_SET(es->wake_sock, &in_set);
+        max_fd = MAX(es->listen_sock, es->wake_sock);
 
-        for(uint8_t i = 0; i < EVENTSOURCE_MAXCON; i++)
+        for(uint8_t i = 0; i < es->config.max_sessions; i++)
         {
-            int fd = conns[i];
+            int fd = es->sessions[i].fd;
             if(fd > max_fd) max_fd = fd;
             if(fd > 0) FD_SET(fd, &in_set);
         }
 
-        int active = select(max_fd + 1, &in_set, NULL, NULL, NULL);
-        ESP_LOGD(TAG, "Task woke up");
+        //Wake up to continue a replay and for the next rate limit slot, otherwise block until something happens
+        TickType_t wait = MIN(replay_wait, rate_wait);
+        uint32_t wait_ms = wait * portTICK_PERIOD_MS;
+        struct timeval timeout = { wait_ms / 1000, (wait_ms % 1000) * 1000 };
+        int active = select(max_fd + 1, &in_set, NULL, NULL, (wait == portMAX_DELAY) ? NULL : &timeout);
+        ESP_LOGD(tag, "Task woke up");
         if(active > 0) {
+            if(FD_ISSET(es->wake_sock, &in_set)) {
+                wake_consume(es);
+                if(atomic_exchange(&es->evict_requested, false)) sess_evict_oldest(es);
+            }
+
             //New connection requested
-            if(FD_ISSET(listen_sock, &in_set)) {
-                int new_sess = sess_accept();
-                if(new_sess < 0) {
-                    ESP_LOGE(TAG, "Failed to accept connection!");
-                }
+            if(FD_ISSET(es->listen_sock, &in_set)) {
+                sess_accept(es);
             }
 
             //Process received data
-            for(uint8_t i = 0; i < EVENTSOURCE_MAXCON; i++)
+            for(uint8_t i = 0; i < es->config.max_sessions; i++)
             {
-                int fd = conns[i];
+                int fd = es->sessions[i].fd;
                 if(fd > 0 && FD_ISSET(fd, &in_set)) {
 
-                    size_t chunksize = read(fd, rx_buf, EVENTSOURCE_RXSIZE);
-                    if(chunksize){
-                        sess_recv(i, chunksize);
+                    size_t held = 0;
+#if EVENTSOURCE_WS_SUPPORT
+                    held = ws_restore(es, i);
+#endif
+                    ssize_t chunksize = read(fd, es->rx_buf + held, es->config.rx_size - 1 - held);
+                    if(chunksize > 0){
+                        sess_recv(es, i, held + chunksize);
+                    } else {
+                        //Peer closed the connection or the socket failed
+                        sess_close(es, i);
                     }
                 }
             }
         }
+
+        frames_drain(es);
+        rate_wait = es->rate_sessions ? sessions_rate_flush(es) : portMAX_DELAY;
+        if(es->log != NULL) replay_wait = sessions_replay(es);
     }
 
     fail:
-    running = false;
-    ESP_LOGI(TAG, "Stopped HTML5 EventSource");
-    vTaskDelete(NULL);
-}
-
-static esp_err_t prepare_output_eventstr(int id, const char* event, const char* data)
-{
-    xSemaphoreTake(x_mutex, portMAX_DELAY);
-
-    esp_err_t ret = ESP_OK;
-
-    static const char* id_header = "id: ";
-    static const char* event_header = "event: ";
-    static const char* data_header = "data: ";
-
-    size_t event_header_len = strlen(event_header);
-    size_t data_header_len = strlen(data_header);
-
-    size_t total_len = 0;
-    //Ensure first char in TX Buffer is a null terminator for strcat to work
-    tx_buf[0] = 0;
+    es->running = false;
 
-    if(id >= 0)
+    for(uint8_t i = 0; i < es->config.max_sessions; i++)
     {
-        strcpy(tx_buf, id_header);
-        sprintf(tx_buf + strlen(id_header), "%d", id);
-        strcat(tx_buf, "\n");
-        total_len += strlen(tx_buf);
+        if(es->sessions[i].fd > 0) sess_close(es, i);
     }
+    if(es->listen_sock >= 0) close(es->listen_sock);
+    es->listen_sock = -1;
+    wake_close(es);
 
-    if(event != NULL)
+    //Release frames that were queued after the last drain
+    uint8_t frame;
+    while(ring_pop(&es->pending_ring, &frame))
     {
-        total_len += strlen(event) + 1;
-        total_len += event_header_len;
+        frame_free(es, frame);
     }
 
-    if(data != NULL)
+    ESP_LOGI(tag, "Stopped HTML5 EventSource");
+    xSemaphoreGive(es->stopped_sem);
+    //Last access to the instance, eventsource_destroy refuses to free it before
+    es->task_handle = NULL;
+    vTaskDelete(NULL);
+}
+
+static esp_err_t frame_reserve(eventsource_t* es, int session, int id, const char* event, bool data_line, size_t len, eventsource_span_t* span, bool from_isr)
+{
+    if(span == NULL) return ESP_ERR_INVALID_ARG;
+    span->data = NULL;
+    span->len = 0;
+    span->frame = -1;
+    if(es == NULL || session >= es->config.max_sessions) return ESP_ERR_INVALID_ARG;
+    if(session < 0 && session != EVENTSOURCE_SESSION_ALL) return ESP_ERR_INVALID_ARG;
+
+    uint8_t i;
+    if(!frame_alloc(es, &i))
     {
-        total_len += strlen(data) + 1;
-        total_len += data_header_len;
+        //Tasks may wait for eventsource_task to free a frame, ISRs and the eventsource_task itself can't
+        bool can_wait = !from_isr && xTaskGetCurrentTaskHandle() != es->task_handle;
+        TickType_t waited = 0;
+        while(true)
+        {
+            if(!can_wait || waited >= (EVENTSOURCE_PUBLISH_TIMEOUT_ms/portTICK_PERIOD_MS))
+            {
+                atomic_fetch_add_explicit(&es->dropped, 1, memory_order_relaxed);
+                return ESP_ERR_NO_MEM;
+            }
+            vTaskDelay(1);
+            waited++;
+            if(frame_alloc(es, &i)) break;
+        }
     }
 
-    if(total_len == 0)
+    frame_t* frame = frame_at(es, i);
+    size_t tx_size = es->config.tx_size;
+    //Leave room for the line and frame terminators
+    size_t header_len = sse_format_header(frame_buf(frame), tx_size - SSE_TRAILER_LEN, id, event, data_line);
+    size_t capacity = tx_size - header_len - SSE_TRAILER_LEN;
+    if(header_len == 0 || len > capacity)
     {
-        ESP_LOGE(TAG, "Couldn't send event as input was empty!");
-        ret = ESP_FAIL;
-        goto fail;
+        frame_free(es, i);
+        return ESP_ERR_INVALID_SIZE;
     }
 
-    if((total_len + 2) > EVENTSOURCE_TXSIZE)
+    frame->session = session;
+    frame->id = id;
+    frame->data_line = data_line;
+    frame->len = header_len;
+
+    span->data = frame_buf(frame) + header_len;
+    span->len = capacity;
+    span->frame = i;
+    return ESP_OK;
+}
+
+/**
+ * Reserves space for the data of an event directly in a frame of the outgoing queue.
+ * The id and event headers are already written, the producer only needs to fill span->data.
+ * Every successful reservation has to be finished by either eventsource_commit or eventsource_discard.
+ * Waits up to EVENTSOURCE_PUBLISH_TIMEOUT_ms if all frames are in use.
+ * @param session (use EVENTSOURCE_SESSION_ALL to send the event to all sessions)
+ * @param id (use -1 to not send id header)
+ * @param event (use NULL to not send event header)
+ * @param len minimum number of data bytes needed, span->len contains the actual capacity
+ */
+esp_err_t eventsource_reserve(eventsource_handle_t es, int session, int id, const char* event, size_t len, eventsource_span_t* span)
+{
+    esp_err_t ret = frame_reserve(es, session, id, event, true, len, span, false);
+    if(ret == ESP_ERR_INVALID_SIZE)
     {
-        ESP_LOGE(TAG, "Failed to send event! Input too large! Increase EVENTSOURCE_TXSIZE");
-        ret = ESP_FAIL;
-        goto fail;
+        ESP_LOGE(es->config.name, "Failed to reserve %u bytes! Increase tx_size", (unsigned)len);
     }
-
-    if(event != NULL)
+    else if(ret == ESP_ERR_NO_MEM)
     {
-        strcat(tx_buf, "event: ");
-        strcat(tx_buf, event);
-        strcat(tx_buf, "\n");
+        ESP_LOGE(es->config.name, "Failed to reserve frame! Queue is full");
     }
+    return ret;
+}
 
-    if(data != NULL)
+/**
+ * Same as eventsource_reserve, but fails immediately instead of waiting for a free frame
+ * Safe to call from an ISR
+ */
+esp_err_t eventsource_reserve_from_isr(eventsource_handle_t es, int session, int id, const char* event, size_t len, eventsource_span_t* span)
+{
+    return frame_reserve(es, session, id, event, true, len, span, true);
+}
+
+static esp_err_t frame_commit(eventsource_t* es, eventsource_span_t* span, size_t used_len, bool from_isr)
+{
+    if(es == NULL || span == NULL || span->frame < 0) return ESP_ERR_INVALID_ARG;
+    if(used_len > span->len)
     {
-        strcat(tx_buf, "data: ");
-        strcat(tx_buf, data);
-        strcat(tx_buf, "\n");
+        eventsource_discard(es, span);
+        return ESP_ERR_INVALID_SIZE;
     }
-    strcat(tx_buf, "\n");
 
+    frame_t* frame = frame_at(es, span->frame);
+    char* end = span->data + used_len;
+    end += sse_format_trailer(end, frame->data_line);
+    frame->len = end - frame_buf(frame);
 
+    //Pending ring can hold every frame, so this never fails
+    ring_push(&es->pending_ring, span->frame);
+    if(from_isr) wake_signal_from_isr(es);
+    else wake_signal(es);
 
-    fail:
-    xSemaphoreGive(x_mutex);
-    return ret;
+    span->data = NULL;
+    span->len = 0;
+    span->frame = -1;
+    return ESP_OK;
+}
+
+/**
+ * Terminates the reserved event after @param used_len bytes of data and queues it for sending
+ * The data must not contain line breaks
+ */
+esp_err_t eventsource_commit(eventsource_handle_t es, eventsource_span_t* span, size_t used_len)
+{
+    return frame_commit(es, span, used_len, false);
+}
+
+/**
+ * ISR safe variant of eventsource_commit
+ */
+esp_err_t eventsource_commit_from_isr(eventsource_handle_t es, eventsource_span_t* span, size_t used_len)
+{
+    return frame_commit(es, span, used_len, true);
+}
+
+/**
+ * Releases a reservation without sending anything
+ * Safe to call from an ISR
+ */
+void eventsource_discard(eventsource_handle_t es, eventsource_span_t* span)
+{
+    if(es == NULL || span == NULL || span->frame < 0) return;
+    frame_free(es, span->frame);
+    span->data = NULL;
+    span->len = 0;
+    span->frame = -1;
+}
+
+static esp_err_t send_eventstr(eventsource_t* es, int session, int id, const char* event, const char* data, bool from_isr)
+{
+    if(id < 0 && event == NULL && data == NULL) return ESP_ERR_INVALID_ARG;
+
+    size_t data_len = (data != NULL) ? strlen(data) : 0;
+
+    eventsource_span_t span;
+    esp_err_t ret = frame_reserve(es, session, id, event, data != NULL, data_len, &span, from_isr);
+    if(ret != ESP_OK) return ret;
+    if(data_len) memcpy(span.data, data, data_len);
+    return frame_commit(es, &span, data_len, from_isr);
 }
 
 /**
@@ -280,10 +1377,23 @@ static esp_err_t prepare_output_eventstr(int id, const char* event, const char*
  * @param event (use NULL to not send event header)
  * @param data (use NULL to not send line of data)
  */
-esp_err_t eventsource_send_eventstr(int session, int id, const char* event, const char* data)
+esp_err_t eventsource_send_eventstr(eventsource_handle_t es, int session, int id, const char* event, const char* data)
 {
-    if(prepare_output_eventstr(id, event, data) != ESP_OK) return ESP_FAIL;
-    return sess_write(session, tx_buf, strlen(tx_buf));
+    esp_err_t ret = send_eventstr(es, session, id, event, data, false);
+    const char* tag = (es != NULL) ? es->config.name : TAG;
+    if(ret == ESP_ERR_INVALID_ARG)
+    {
+        ESP_LOGE(tag, "Couldn't send event as input was empty!");
+    }
+    else if(ret == ESP_ERR_INVALID_SIZE)
+    {
+        ESP_LOGE(tag, "Failed to send event! Input too large! Increase tx_size");
+    }
+    else if(ret == ESP_ERR_NO_MEM)
+    {
+        ESP_LOGE(tag, "Failed to send event! Queue is full");
+    }
+    return ret;
 }
 
 
@@ -291,67 +1401,337 @@ esp_err_t eventsource_send_eventstr(int session, int id, const char* event, cons
  * Sends an event to all sessions
  * See @link #eventsource_send_eventstr
  */
-esp_err_t eventsource_sendall_eventstr(int id, const char* event, const char* data)
+esp_err_t eventsource_sendall_eventstr(eventsource_handle_t es, int id, const char* event, const char* data)
 {
-    if(prepare_output_eventstr(id, event, data) != ESP_OK) return ESP_FAIL;
-    for(uint8_t i = 0; i<EVENTSOURCE_MAXCON; i++)
-    {
-        sess_write(i, tx_buf, strlen(tx_buf));
-    }
-    return ESP_OK;
+    return eventsource_send_eventstr(es, EVENTSOURCE_SESSION_ALL, id, event, data);
+}
+
+/**
+ * ISR safe variant of eventsource_send_eventstr. Drops the event if the queue is full
+ */
+esp_err_t eventsource_send_eventstr_from_isr(eventsource_handle_t es, int session, int id, const char* event, const char* data)
+{
+    return send_eventstr(es, session, id, event, data, true);
+}
+
+/**
+ * ISR safe variant of eventsource_sendall_eventstr. Drops the event if the queue is full
+ */
+esp_err_t eventsource_sendall_eventstr_from_isr(eventsource_handle_t es, int id, const char* event, const char* data)
+{
+    return send_eventstr(es, EVENTSOURCE_SESSION_ALL, id, event, data, true);
+}
+
+/**
+ * @return number of events dropped because the queue was full
+ */
+unsigned int eventsource_get_dropped(eventsource_handle_t es)
+{
+    return atomic_load_explicit(&es->dropped, memory_order_relaxed);
+}
+
+/**
+ * @return id of the newest logged event or -1 without log. Continue counting from here after a reboot,
+ * ids of previous boots are known once the flush task opened the log on the mounted filesystem
+ */
+int eventsource_get_last_id(eventsource_handle_t es)
+{
+    return (es->log != NULL) ? eventlog_get_last_id(es->log) : -1;
+}
+
+/**
+ * Sets how new connections are handled when all sessions are in use
+ */
+void eventsource_set_admission(eventsource_handle_t es, eventsource_admission_t policy)
+{
+    es->config.admission = policy;
+}
+
+/**
+ * Sets callback which receives text and binary messages of WebSocket sessions
+ */
+void eventsource_set_message_cb(eventsource_handle_t es, eventsource_message_cb_t cb)
+{
+    es->message_cb = cb;
 }
 
 /**
  * Sets callback which gets notified after a client gets accepted
  */
-void eventsource_set_joined_cb(eventsource_joined_cb_t cb)
+void eventsource_set_joined_cb(eventsource_handle_t es, eventsource_joined_cb_t cb)
 {
-    joined_cb = cb;
+    es->joined_cb = cb;
 }
 
-void eventsource_init(void)
+//Size of the instance including all buffers, laid out by instance_layout
+static size_t instance_memsize(const eventsource_config_t* config, size_t* frame_stride)
 {
-    if(rx_buf == NULL) rx_buf = (char*)calloc(EVENTSOURCE_RXSIZE, sizeof(char));
-    if(tx_buf == NULL) tx_buf = (char*)calloc(EVENTSOURCE_TXSIZE, sizeof(char));
-    if(x_mutex == NULL) x_mutex = xSemaphoreCreateMutex();
+    *frame_stride = EVENTSOURCE_ALIGN(sizeof(frame_t) + EVENTSOURCE_WS_HEADROOM + config->tx_size);
+    return EVENTSOURCE_ALIGN(sizeof(eventsource_t))
+            + EVENTSOURCE_ALIGN(config->max_sessions * sizeof(sess_t))
+            + 2 * EVENTSOURCE_ALIGN(config->queue_len * sizeof(ring_cell_t))
+            + config->queue_len * *frame_stride
+            + EVENTSOURCE_ALIGN(config->rx_size)
+            + ((EVENTSOURCE_WS_SUPPORT && config->ws_endpoint) ? EVENTSOURCE_ALIGN(config->max_sessions * config->ws_rx_size) : 0)
+            + (config->log_path ? EVENTSOURCE_ALIGN(config->tx_size) : 0)
+            + EVENTSOURCE_ALIGN(config->rate_limit_types * config->tx_size)
+            + (config->compress_window ? config->max_sessions * DEFLATE_MEMSIZE(config->compress_window)
+                    + DEFLATE_BOUND(config->tx_size) : 0);
 }
 
-void eventsource_start(void)
+static void instance_layout(eventsource_t* es, size_t frame_stride)
 {
-    if(running) {
-        ESP_LOGE(TAG, "Failed to start EventSource as it is already running!");
-        return;
+    const eventsource_config_t* config = &es->config;
+    uint8_t* mem = (uint8_t*)es + EVENTSOURCE_ALIGN(sizeof(eventsource_t));
+
+    es->sessions = (sess_t*)mem;
+    mem += EVENTSOURCE_ALIGN(config->max_sessions * sizeof(sess_t));
+    ring_init(&es->free_ring, (ring_cell_t*)mem, config->queue_len);
+    mem += EVENTSOURCE_ALIGN(config->queue_len * sizeof(ring_cell_t));
+    ring_init(&es->pending_ring, (ring_cell_t*)mem, config->queue_len);
+    mem += EVENTSOURCE_ALIGN(config->queue_len * sizeof(ring_cell_t));
+    es->frames = mem;
+    es->frame_stride = frame_stride;
+    mem += config->queue_len * frame_stride;
+    es->rx_buf = (char*)mem;
+    mem += EVENTSOURCE_ALIGN(config->rx_size);
+    if(EVENTSOURCE_WS_SUPPORT && config->ws_endpoint)
+    {
+        es->ws_rx_mem = (char*)mem;
+        mem += EVENTSOURCE_ALIGN(config->max_sessions * config->ws_rx_size);
+    }
+    if(config->log_path)
+    {
+        es->replay_buf = (char*)mem;
+        mem += EVENTSOURCE_ALIGN(config->tx_size);
+    }
+    if(config->rate_limit_types)
+    {
+        es->rate_buf = (char*)mem;
+        mem += EVENTSOURCE_ALIGN(config->rate_limit_types * config->tx_size);
+    }
+    if(config->compress_window)
+    {
+        es->deflate_mem = mem;
+        mem += config->max_sessions * DEFLATE_MEMSIZE(config->compress_window);
+        es->deflate_buf = mem;
+    }
+}
+
+static eventsource_t* instance_alloc(size_t size)
+{
+#if MEMPOOL_STATIC
+    if(size > EVENTSOURCE_STATIC_MEMSIZE) return NULL;
+    eventsource_t* es = NULL;
+    portENTER_CRITICAL(&instances_mux);
+    for(uint8_t i = 0; i < EVENTSOURCE_STATIC_INSTANCES; i++)
+    {
+        if(!instance_used[i])
+        {
+            instance_used[i] = true;
+            es = (eventsource_t*)instance_mem[i];
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&instances_mux);
+    if(es != NULL) memset(es, 0, size);
+    return es;
+#else
+    return (eventsource_t*)calloc(1, size);
+#endif
+}
+
+static void instance_free(eventsource_t* es)
+{
+#if MEMPOOL_STATIC
+    portENTER_CRITICAL(&instances_mux);
+    for(uint8_t i = 0; i < EVENTSOURCE_STATIC_INSTANCES; i++)
+    {
+        if(es == (eventsource_t*)instance_mem[i]) instance_used[i] = false;
+    }
+    portEXIT_CRITICAL(&instances_mux);
+#else
+    free(es);
+#endif
+}
+
+/**
+ * Creates an eventsource instance, the task is started by eventsource_start
+ * The strings in @param config have to stay valid as long as the instance exists
+ */
+esp_err_t eventsource_init(eventsource_handle_t* handle, const eventsource_config_t* config)
+{
+    if(handle == NULL || config == NULL) return ESP_ERR_INVALID_ARG;
+    *handle = NULL;
+    if(config->name == NULL || config->name[0] == 0 || config->max_sessions == 0 || config->rx_size < 2 || config->tx_size <= SSE_TRAILER_LEN
+            || config->queue_len == 0 || (config->queue_len & (config->queue_len - 1)) || config->backlog == 0
+            || config->compress_window > 32768 || (config->compress_window & (config->compress_window - 1))
+            || (config->compress_window && config->compress_window < 64)
+            || config->rate_limit_types > EVENTSOURCE_RATE_MAX_TYPES
+            //Server frames carry at most a 16 bit length, a held frame needs room for the rest of it in rx_buf
+            || (config->ws_endpoint && (config->tx_size > 65535 || config->ws_rx_size < 8 || config->ws_rx_size > 65535 || config->ws_rx_size >= config->rx_size)))
+    {
+        ESP_LOGE(TAG, "Invalid EventSource config!");
+        return ESP_ERR_INVALID_ARG;
+    }
+#if MEMPOOL_STATIC
+    if(config->task_stack > EVENTSOURCE_STATIC_TASK_STACK)
+    {
+        ESP_LOGE(TAG, "Task stack too large! Increase EVENTSOURCE_STATIC_TASK_STACK");
+        return ESP_ERR_INVALID_SIZE;
+    }
+#endif
+
+    size_t frame_stride;
+    size_t size = instance_memsize(config, &frame_stride);
+    eventsource_t* es = instance_alloc(size);
+    if(es == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes for EventSource %s", (unsigned)size, config->name);
+        return ESP_ERR_NO_MEM;
+    }
+
+    es->config = *config;
+    instance_layout(es, frame_stride);
+    for(uint8_t i = 0; i < config->queue_len; i++)
+    {
+        ring_push(&es->free_ring, i);
+    }
+    for(uint8_t i = 0; i < config->max_sessions; i++)
+    {
+        es->sessions[i].fd = -1;
     }
+    atomic_init(&es->dropped, 0);
+    atomic_init(&es->evict_requested, false);
+    atomic_flag_clear(&es->wake_pending);
+    es->listen_sock = -1;
+    es->wake_sock = -1;
 
-    running = true;
+#if MEMPOOL_STATIC
+    es->stopped_sem = xSemaphoreCreateBinaryStatic(&es->stopped_sem_mem);
+#else
+    es->stopped_sem = xSemaphoreCreateBinary();
+#endif
 
+    snprintf(es->frames_pool_name, sizeof(es->frames_pool_name), "%s_frames", config->name);
+    snprintf(es->sessions_pool_name, sizeof(es->sessions_pool_name), "%s_sessions", config->name);
+    mempool_register(&es->frames_pool, es->frames_pool_name, frame_stride, config->queue_len);
+    mempool_register(&es->sessions_pool, es->sessions_pool_name, sizeof(sess_t), config->max_sessions);
 
-    xTaskCreate(eventsource_task, "eventsource", 4096, NULL, 5, NULL);
+    bool registered = false;
+    portENTER_CRITICAL(&instances_mux);
+    for(uint8_t i = 0; i < EVENTSOURCE_MAX_INSTANCES; i++)
+    {
+        if(instances[i] == NULL)
+        {
+            instances[i] = es;
+            registered = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&instances_mux);
+    if(!registered)
+    {
+        ESP_LOGE(TAG, "Too many EventSource instances! Increase EVENTSOURCE_MAX_INSTANCES");
+        eventsource_destroy(es);
+        return ESP_ERR_NO_MEM;
+    }
+
+    if(config->log_path != NULL && eventlog_init(&es->log, config->log_path) != ESP_OK)
+    {
+        eventsource_destroy(es);
+        return ESP_ERR_NO_MEM;
+    }
+
+    sockbudget_init();
+    sockbudget_set_evict_cb(SOCKBUDGET_SSE, sess_evict_request);
+
+    *handle = es;
+    return ESP_OK;
 }
 
-void eventsource_stop(void)
+esp_err_t eventsource_start(eventsource_handle_t es)
 {
-    if(!running) {
-        ESP_LOGE(TAG, "Failed to stop EventSource as it is not running!");
-        return;
+    if(es->running || es->task_handle != NULL) {
+        ESP_LOGE(es->config.name, "Failed to start EventSource as it is already running!");
+        return ESP_ERR_INVALID_STATE;
     }
 
-    running = false;
+    es->running = true;
+    //Discard a stop notification left over from a task that failed to start
+    xSemaphoreTake(es->stopped_sem, 0);
 
+    const eventsource_config_t* config = &es->config;
+#if MEMPOOL_STATIC
+    StackType_t* stack = NULL;
+    for(uint8_t i = 0; i < EVENTSOURCE_STATIC_INSTANCES; i++)
+    {
+        if(es == (eventsource_t*)instance_mem[i]) stack = task_stacks[i];
+    }
+    es->task_handle = xTaskCreateStaticPinnedToCore(eventsource_task, config->name, config->task_stack, es,
+            config->task_priority, stack, &es->task_mem, config->task_core);
+    if(es->task_handle == NULL)
+#else
+    if(xTaskCreatePinnedToCore(eventsource_task, config->name, config->task_stack, es,
+            config->task_priority, &es->task_handle, config->task_core) != pdPASS)
+#endif
+    {
+        ESP_LOGE(config->name, "Failed to create EventSource task!");
+        es->running = false;
+        return ESP_FAIL;
+    }
+    return ESP_OK;
 }
 
-void eventsource_destroy(void)
+/**
+ * Stops the task and closes all sessions
+ * @return ESP_ERR_TIMEOUT if the task didn't exit within EVENTSOURCE_STOP_TIMEOUT_ms, the instance must not be destroyed then.
+ * Called from the task itself (e.g. a callback) it only requests the stop and the task exits after the callback returned
+ */
+esp_err_t eventsource_stop(eventsource_handle_t es)
 {
-    if(running) {
-        ESP_LOGE(TAG, "Failed to destroy EventSource as it is still running!");
+    if(!es->running) {
+        ESP_LOGE(es->config.name, "Failed to stop EventSource as it is not running!");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    es->running = false;
+    wake_signal(es);
+
+    //The task can't wait for itself, e.g. when stopped from the joined callback
+    if(xTaskGetCurrentTaskHandle() == es->task_handle) return ESP_OK;
+    if(xSemaphoreTake(es->stopped_sem, EVENTSOURCE_STOP_TIMEOUT_ms/portTICK_PERIOD_MS) != pdTRUE)
+    {
+        ESP_LOGE(es->config.name, "EventSource task didn't stop in time!");
+        return ESP_ERR_TIMEOUT;
+    }
+    //The task clears its handle right after giving the semaphore
+    while(es->task_handle != NULL) vTaskDelay(1);
+    return ESP_OK;
+}
+
+/**
+ * Frees the instance, refused while the task still runs (see eventsource_stop)
+ */
+void eventsource_destroy(eventsource_handle_t es)
+{
+    if(es == NULL) return;
+    if(es->running || es->task_handle != NULL) {
+        ESP_LOGE(es->config.name, "Failed to destroy EventSource as its task is still running!");
         return;
     }
 
-    if(rx_buf != NULL) free(rx_buf);
-    if(tx_buf != NULL) free(tx_buf);
-    if(x_mutex != NULL) vSemaphoreDelete(x_mutex);
-    rx_buf = NULL;
-    tx_buf = NULL;
-    x_mutex = NULL;
+    portENTER_CRITICAL(&instances_mux);
+    for(uint8_t i = 0; i < EVENTSOURCE_MAX_INSTANCES; i++)
+    {
+        if(instances[i] == es) instances[i] = NULL;
+    }
+    portEXIT_CRITICAL(&instances_mux);
+
+    mempool_unregister(&es->frames_pool);
+    mempool_unregister(&es->sessions_pool);
+    eventlog_deinit(es->log);
+    if(es->stopped_sem != NULL) vSemaphoreDelete(es->stopped_sem);
+    instance_free(es);
 }
 
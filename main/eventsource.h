@@ -2,21 +2,114 @@
 #define NET_EVENTSOURCE_H
 
 #include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 /**
  * Implementation of a TCP server for HTML5 Server-Sent-Events (EventSource in JavaScript)
+ * Clients can also connect with a WebSocket to /api.ws. They receive the same events (one text message per event
+ * in the Server-Sent-Events format) and can send messages back to the server.
+ * Several independent instances can run at once, each with its own port, task and buffers.
+ * With compress_window set, SSE clients sending Accept-Encoding: gzip or deflate receive a compressed stream.
+ * With log_path set, events sent to all sessions with an id are kept in a flash log (see eventlog.h)
+ * and reconnecting clients receive the events after their Last-Event-ID before the live stream.
+ * With rate_limit_types set, SSE clients requesting e.g. /api.sse?maxrate=2 receive at most that many broadcast
+ * events per second of every event type. Events in between are coalesced, only the latest one of a type is sent.
+ * Intervals (?interval=<ms> or 1000/maxrate) up to 5 minutes are accepted, other values are ignored.
  */
 
-typedef esp_err_t (*eventsource_joined_cb_t) (int session);
+#define EVENTSOURCE_SESSION_ALL -1
 
-void eventsource_init(void);
-void eventsource_start(void);
-void eventsource_stop(void);
-void eventsource_destroy(void);
+typedef struct eventsource* eventsource_handle_t;
 
-void eventsource_set_joined_cb(eventsource_joined_cb_t cb);
+typedef esp_err_t (*eventsource_joined_cb_t) (eventsource_handle_t es, int session);
+typedef esp_err_t (*eventsource_message_cb_t) (eventsource_handle_t es, int session, const char* msg);
 
-esp_err_t eventsource_send_eventstr(int session, int id, const char* event, const char* data);
-esp_err_t eventsource_sendall_eventstr(int id, const char* event, const char* data);
+//Handling of new connections when all sessions are in use
+typedef enum {
+    EVENTSOURCE_ADMIT_REJECT = 0,       //Answer new connections with 503
+    EVENTSOURCE_ADMIT_EVICT_IDLE,       //Close a connection that never requested the stream, otherwise reject
+    EVENTSOURCE_ADMIT_EVICT_OLDEST      //Close an idle connection or the oldest session
+} eventsource_admission_t;
+
+/**
+ * Settings of one eventsource instance, start from EVENTSOURCE_DEFAULT_CONFIG()
+ * Every instance uses two lwIP sockets besides its sessions (listening and wakeup socket),
+ * the socket budget has to be lowered with sockbudget_set_total when running more than one.
+ */
+typedef struct {
+    const char* name;               //Task name and log prefix
+    uint16_t port;
+    const char* endpoint;           //Path of the Server-Sent-Events stream
+    const char* ws_endpoint;        //Path of the WebSocket transport, NULL to disable it
+    uint8_t max_sessions;
+    size_t rx_size;                 //Receive buffer, limits the size of requests
+    size_t ws_rx_size;              //Per session buffer for WebSocket frames split across reads, limits the size of client frames
+    size_t tx_size;                 //Largest event including its headers
+    uint8_t queue_len;              //Number of events that can be queued for sending. Must be a power of two
+    eventsource_admission_t admission;
+    uint8_t backlog;                //Connections waiting in the listen queue of the TCP stack
+    size_t compress_window;         //Window of the per session SSE compression (power of two up to 32768), 0 to disable
+    const char* log_path;           //Prefix of the event log files, e.g. "/spiffs/events". NULL to disable the log
+    uint8_t rate_limit_types;       //Event types (up to 8) SSE clients can rate limit with ?maxrate=<events/s> or ?interval=<ms>, 0 to disable
+    UBaseType_t task_priority;
+    uint32_t task_stack;
+    BaseType_t task_core;           //Core the task is pinned to or tskNO_AFFINITY
+} eventsource_config_t;
+
+#define EVENTSOURCE_DEFAULT_CONFIG() {          \
+        .name = "eventsource",                  \
+        .port = 8080,                           \
+        .endpoint = "/api.sse",                 \
+        .ws_endpoint = "/api.ws",               \
+        .max_sessions = 5,                      \
+        .rx_size = 4096,                        \
+        .ws_rx_size = 256,                      \
+        .tx_size = 1024,                        \
+        .queue_len = 8,                         \
+        .admission = EVENTSOURCE_ADMIT_REJECT,  \
+        .backlog = 4,                           \
+        .compress_window = 0,                   \
+        .log_path = NULL,                       \
+        .rate_limit_types = 0,                  \
+        .task_priority = 5,                     \
+        .task_stack = 4096,                     \
+        .task_core = tskNO_AFFINITY             \
+}
+
+/**
+ * Writable part of a reserved event inside the outgoing buffer
+ */
+typedef struct {
+    char* data;     //Start of the data field
+    size_t len;     //Number of bytes that may be written to data
+
+    //Private
+    int frame;
+} eventsource_span_t;
+
+esp_err_t eventsource_init(eventsource_handle_t* handle, const eventsource_config_t* config);
+esp_err_t eventsource_start(eventsource_handle_t es);
+esp_err_t eventsource_stop(eventsource_handle_t es);
+void eventsource_destroy(eventsource_handle_t es);
+
+void eventsource_set_joined_cb(eventsource_handle_t es, eventsource_joined_cb_t cb);
+void eventsource_set_admission(eventsource_handle_t es, eventsource_admission_t policy);
+void eventsource_set_message_cb(eventsource_handle_t es, eventsource_message_cb_t cb);
+
+esp_err_t eventsource_send_eventstr(eventsource_handle_t es, int session, int id, const char* event, const char* data);
+esp_err_t eventsource_sendall_eventstr(eventsource_handle_t es, int id, const char* event, const char* data);
+
+esp_err_t eventsource_reserve(eventsource_handle_t es, int session, int id, const char* event, size_t len, eventsource_span_t* span);
+esp_err_t eventsource_commit(eventsource_handle_t es, eventsource_span_t* span, size_t used_len);
+void eventsource_discard(eventsource_handle_t es, eventsource_span_t* span);
+
+esp_err_t eventsource_send_eventstr_from_isr(eventsource_handle_t es, int session, int id, const char* event, const char* data);
+esp_err_t eventsource_sendall_eventstr_from_isr(eventsource_handle_t es, int id, const char* event, const char* data);
+esp_err_t eventsource_reserve_from_isr(eventsource_handle_t es, int session, int id, const char* event, size_t len, eventsource_span_t* span);
+esp_err_t eventsource_commit_from_isr(eventsource_handle_t es, eventsource_span_t* span, size_t used_len);
+
+unsigned int eventsource_get_dropped(eventsource_handle_t es);
+int eventsource_get_last_id(eventsource_handle_t es);
 
 #endif
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "driver/gpio.h"
@@ -7,32 +8,38 @@
 #include "wifi.h"
 #include "webserver.h"
 #include "eventsource.h"
+#include "bootprof.h"
+#include "mempool.h"
 #include "esp_log.h"
 
 static const char* TAG = "MAIN";
 
 static volatile bool execution_needed = false;
 
+//Stream of the webinterface
+static eventsource_handle_t ui_stream = NULL;
+
 static esp_err_t webinterface_template_cb(httpd_req_t* req, const char* filename, uint8_t i)
 {
     if(!strcmp(filename, "/spiffs/index.html")){
         switch(i)
         {
         case 0:
-            httpd_resp_sendstr_chunk(req, "A");
+            webserver_template_sendstr(req, "A");
             break;
         case 1:
-            httpd_resp_sendstr_chunk(req, "B");
+            webserver_template_sendstr(req, "B");
             break;
         case 2:
-            httpd_resp_sendstr_chunk(req, "");
+            webserver_template_sendstr(req, "");
             break;
         }
     }
     return ESP_OK;
 }
 
-static esp_err_t webinterface_api_cb(httpd_req_t* req, const char* api_call)
+//Shared by the HTTP API and WebSocket messages
+static esp_err_t webinterface_api_dispatch(const char* api_call)
 {
     //Do not execute heavy loads in this function. Another thread needs to be used as this callback shouldn't do any blocking IO
     //Use queue, etc.
@@ -42,13 +49,35 @@ static esp_err_t webinterface_api_cb(httpd_req_t* req, const char* api_call)
         ESP_LOGI(TAG,"API: Executing...");
         execution_needed = true;
     }
+#ifdef CONFIG_WEBIF_ECHO_API
+    else if(!strncmp(api_call, "echo=", 5))
+    {
+        //Publishes the argument back to all clients. Used by tools/sse_swarm.py to measure delivery latency
+        //A line break would let the client inject fields or whole events into every stream
+        if(strpbrk(api_call + 5, "\r\n") != NULL) return ESP_ERR_INVALID_ARG;
+        return eventsource_sendall_eventstr(ui_stream, -1, "echo", api_call + 5);
+    }
+#endif
 
     return ESP_OK;
 }
 
-static esp_err_t webinterface_joined_cb(int session)
+static esp_err_t webinterface_api_cb(httpd_req_t* req, const char* api_call)
+{
+    return webinterface_api_dispatch(api_call);
+}
+
+static esp_err_t webinterface_message_cb(eventsource_handle_t es, int session, const char* msg)
+{
+    esp_err_t ret = webinterface_api_dispatch(msg);
+    //Acknowledge on the same socket
+    eventsource_send_eventstr(es, session, -1, "api", (ret == ESP_OK) ? "ok" : "failed");
+    return ret;
+}
+
+static esp_err_t webinterface_joined_cb(eventsource_handle_t es, int session)
 {
-    eventsource_send_eventstr(session, -1, "reset", "");
+    eventsource_send_eventstr(es, session, -1, "reset", "");
 
     return ESP_OK;
 }
@@ -65,30 +94,36 @@ void configure_nvs(void)
 
 void configure_network(void)
 {
+    int64_t start;
+
+    //Starts mounting the filesystem in the background while the radio comes up
+    webserver_init();
+    webserver_set_cached_template_cb(webinterface_template_cb);
+    webserver_set_api_cb(webinterface_api_cb);
+
     //Network initialization
+    start = bootprof_now();
     network_wifi_init();
     network_wifi_sta_ap_init();
+    bootprof_mark("wifi_init", start);
+    start = bootprof_now();
     network_wifi_start();
+    bootprof_mark("wifi_start", start);
 
     //Webinterface
-    webserver_init();
-    webserver_set_template_cb(webinterface_template_cb);
-    webserver_set_api_cb(webinterface_api_cb);
     webserver_start();
 
-    eventsource_init();
-    eventsource_start();
-    eventsource_set_joined_cb(webinterface_joined_cb);
-
-
-    if(network_wifi_wait_connected())
+    start = bootprof_now();
+    eventsource_config_t stream_config = EVENTSOURCE_DEFAULT_CONFIG();
+    stream_config.compress_window = 1024;
+    stream_config.rate_limit_types = 4;
+    if(eventsource_init(&ui_stream, &stream_config) == ESP_OK)
     {
-        ESP_LOGI(TAG, "WIFI station connected successfully!");
-    }
-    else
-    {
-        ESP_LOGE(TAG, "WIFI station failed to connect!");
+        eventsource_set_joined_cb(ui_stream, webinterface_joined_cb);
+        eventsource_set_message_cb(ui_stream, webinterface_message_cb);
+        eventsource_start(ui_stream);
     }
+    bootprof_mark("eventsource_start", start);
 }
 
 static void loop_task(void* params)
@@ -100,7 +135,7 @@ static void loop_task(void* params)
             execution_needed = false;
 
         //Reset client view
-        eventsource_sendall_eventstr(-1, "reset", "");
+        eventsource_sendall_eventstr(ui_stream, -1, "reset", "");
     }
     vTaskDelete(NULL);
 }
@@ -108,8 +143,23 @@ static void loop_task(void* params)
 
 void app_main(void)
 {
+    int64_t start = bootprof_now();
     configure_nvs();
+    bootprof_mark("nvs", start);
     configure_network();
 
+    //The AP and the webinterface are usable without the station uplink, don't hold back the application for it
     xTaskCreate(loop_task, "loop", 4096, NULL, 5, NULL);
+
+    if(network_wifi_wait_connected())
+    {
+        ESP_LOGI(TAG, "WIFI station connected successfully!");
+    }
+    else
+    {
+        ESP_LOGE(TAG, "WIFI station failed to connect!");
+    }
+
+    bootprof_report();
+    mempool_report();
 }
@@ -0,0 +1,112 @@
+#include "mempool.h"
+
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+//Pools listed by mempool_report, the rest is only counted
+#define MEMPOOL_REPORT_MAX 16
+
+static const char* TAG = "MEMPOOL";
+
+static mempool_stat_t* pools = NULL;
+static portMUX_TYPE pools_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Adds @param pool of @param capacity blocks with @param block_size bytes each to the report
+ * Registering a pool again only resets its usage
+ */
+void mempool_register(mempool_stat_t* pool, const char* name, size_t block_size, unsigned int capacity)
+{
+    pool->name = name;
+    pool->block_size = block_size;
+    pool->capacity = capacity;
+    atomic_init(&pool->used, 0);
+    atomic_init(&pool->high_water, 0);
+
+    portENTER_CRITICAL(&pools_mux);
+    mempool_stat_t* p = pools;
+    while(p != NULL && p != pool) p = p->next;
+    if(p == NULL)
+    {
+        pool->next = pools;
+        pools = pool;
+    }
+    portEXIT_CRITICAL(&pools_mux);
+}
+
+/**
+ * Removes @param pool from the report, e.g. before its memory is released
+ */
+void mempool_unregister(mempool_stat_t* pool)
+{
+    portENTER_CRITICAL(&pools_mux);
+    mempool_stat_t** p = &pools;
+    while(*p != NULL && *p != pool) p = &(*p)->next;
+    if(*p != NULL) *p = pool->next;
+    portEXIT_CRITICAL(&pools_mux);
+}
+
+/**
+ * Counts one more block of @param pool as used
+ * Safe to call from an ISR
+ */
+void mempool_take(mempool_stat_t* pool)
+{
+    unsigned int used = atomic_fetch_add_explicit(&pool->used, 1, memory_order_relaxed) + 1;
+    unsigned int high_water = atomic_load_explicit(&pool->high_water, memory_order_relaxed);
+    while(used > high_water)
+    {
+        if(atomic_compare_exchange_weak_explicit(&pool->high_water, &high_water, used, memory_order_relaxed, memory_order_relaxed)) break;
+    }
+}
+
+/**
+ * Counts one block of @param pool as released
+ * Safe to call from an ISR
+ */
+void mempool_give(mempool_stat_t* pool)
+{
+    atomic_fetch_sub_explicit(&pool->used, 1, memory_order_relaxed);
+}
+
+unsigned int mempool_get_high_water(mempool_stat_t* pool)
+{
+    return atomic_load_explicit(&pool->high_water, memory_order_relaxed);
+}
+
+/**
+ * Logs capacity, current usage and high-water mark of every registered pool
+ */
+void mempool_report(void)
+{
+    //Take a snapshot, pools may be unregistered while logging
+    struct {
+        char name[24];
+        size_t block_size;
+        unsigned int capacity;
+        unsigned int used;
+        unsigned int high_water;
+    } copy[MEMPOOL_REPORT_MAX];
+    uint8_t count = 0;
+
+    portENTER_CRITICAL(&pools_mux);
+    for(mempool_stat_t* p = pools; p != NULL && count < MEMPOOL_REPORT_MAX; p = p->next)
+    {
+        snprintf(copy[count].name, sizeof(copy[count].name), "%s", p->name);
+        copy[count].block_size = p->block_size;
+        copy[count].capacity = p->capacity;
+        copy[count].used = atomic_load_explicit(&p->used, memory_order_relaxed);
+        copy[count].high_water = mempool_get_high_water(p);
+        count++;
+    }
+    portEXIT_CRITICAL(&pools_mux);
+
+    ESP_LOGI(TAG, "%-20s %8s %8s %8s %8s %10s", "pool", "block", "capacity", "used", "peak", "bytes");
+    for(uint8_t i = 0; i < count; i++)
+    {
+        ESP_LOGI(TAG, "%-20s %8u %8u %8u %8u %10u", copy[i].name, (unsigned)copy[i].block_size, copy[i].capacity,
+                copy[i].used, copy[i].high_water, (unsigned)(copy[i].block_size * copy[i].capacity));
+    }
+    ESP_LOGI(TAG, "%s allocation", MEMPOOL_STATIC ? "Static" : "Heap");
+}
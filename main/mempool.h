@@ -0,0 +1,41 @@
+#ifndef MEMPOOL_H
+#define MEMPOOL_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include "sdkconfig.h"
+
+/**
+ * Usage accounting of fixed size memory pools
+ *
+ * Every pool reports how many of its blocks are in use and the most that ever were (high-water mark),
+ * so the pools can be sized to the actual load of a long-running device.
+ */
+
+//Set with CONFIG_WEBIF_STATIC_ALLOC, modules place their memory in static arenas instead of the heap
+#ifdef CONFIG_WEBIF_STATIC_ALLOC
+#define MEMPOOL_STATIC 1
+#else
+#define MEMPOOL_STATIC 0
+#endif
+
+typedef struct mempool_stat {
+    const char* name;
+    size_t block_size;
+    unsigned int capacity;
+    atomic_uint used;
+    atomic_uint high_water;
+    struct mempool_stat* next;
+} mempool_stat_t;
+
+void mempool_register(mempool_stat_t* pool, const char* name, size_t block_size, unsigned int capacity);
+void mempool_unregister(mempool_stat_t* pool);
+
+void mempool_take(mempool_stat_t* pool);
+void mempool_give(mempool_stat_t* pool);
+
+unsigned int mempool_get_high_water(mempool_stat_t* pool);
+
+void mempool_report(void);
+
+#endif
@@ -0,0 +1,155 @@
+#include "sockbudget.h"
+
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "mempool.h"
+
+//lwIP sockets not available to clients: both listening sockets, httpd control socket and eventsource wakeup socket
+#define SOCKBUDGET_INTERNAL_SOCKETS 4
+#define SOCKBUDGET_DEFAULT_TOTAL (CONFIG_LWIP_MAX_SOCKETS - SOCKBUDGET_INTERNAL_SOCKETS)
+#define SOCKBUDGET_DEFAULT_HTTP_RESERVED 2
+#define SOCKBUDGET_DEFAULT_SSE_RESERVED 2
+
+static const char* TAG = "NET/SockBudget";
+
+static const char* owner_names[SOCKBUDGET_OWNER_COUNT] = { "HTTP", "SSE" };
+
+static uint8_t total = SOCKBUDGET_DEFAULT_TOTAL;
+static uint8_t reserved[SOCKBUDGET_OWNER_COUNT] = { SOCKBUDGET_DEFAULT_HTTP_RESERVED, SOCKBUDGET_DEFAULT_SSE_RESERVED };
+static uint8_t used[SOCKBUDGET_OWNER_COUNT];
+static sockbudget_evict_cb_t evict_cbs[SOCKBUDGET_OWNER_COUNT];
+
+static SemaphoreHandle_t x_mutex = NULL;
+
+static uint8_t used_total(void)
+{
+    uint8_t sum = 0;
+    for(uint8_t i = 0; i < SOCKBUDGET_OWNER_COUNT; i++)
+    {
+        sum += used[i];
+    }
+    return sum;
+}
+
+void sockbudget_init(void)
+{
+#if MEMPOOL_STATIC
+    static StaticSemaphore_t x_mutex_mem;
+    if(x_mutex == NULL) x_mutex = xSemaphoreCreateMutexStatic(&x_mutex_mem);
+#else
+    if(x_mutex == NULL) x_mutex = xSemaphoreCreateMutex();
+#endif
+}
+
+/**
+ * Sets the number of sockets shared by all servers
+ */
+void sockbudget_set_total(uint8_t n)
+{
+    total = n;
+}
+
+/**
+ * Sets the number of sockets that are always available to @param owner
+ */
+void sockbudget_set_reserved(sockbudget_owner_t owner, uint8_t n)
+{
+    if(owner >= SOCKBUDGET_OWNER_COUNT) return;
+    reserved[owner] = n;
+}
+
+/**
+ * Sets callback which gets asked to close an idle socket when another server needs room
+ */
+void sockbudget_set_evict_cb(sockbudget_owner_t owner, sockbudget_evict_cb_t cb)
+{
+    if(owner >= SOCKBUDGET_OWNER_COUNT) return;
+    evict_cbs[owner] = cb;
+}
+
+/**
+ * @return maximum number of sockets @param owner can get, i.e. the budget minus the reservations of all other servers
+ */
+uint8_t sockbudget_get_limit(sockbudget_owner_t owner)
+{
+    uint8_t limit = total;
+    for(uint8_t i = 0; i < SOCKBUDGET_OWNER_COUNT; i++)
+    {
+        if(i != owner) limit -= MIN(reserved[i], limit);
+    }
+    return limit;
+}
+
+/**
+ * Accounts a new client socket of @param owner
+ * @return ESP_OK if the socket may be kept open, otherwise it has to be closed
+ */
+esp_err_t sockbudget_acquire(sockbudget_owner_t owner)
+{
+    if(owner >= SOCKBUDGET_OWNER_COUNT || x_mutex == NULL) return ESP_FAIL;
+
+    xSemaphoreTake(x_mutex, portMAX_DELAY);
+
+    bool granted = false;
+    int8_t victim = -1;
+
+    if(used[owner] < sockbudget_get_limit(owner))
+    {
+        if(used_total() < total)
+        {
+            granted = true;
+        }
+        else if(used[owner] < reserved[owner])
+        {
+            //Someone else is borrowing from our reservation
+            for(uint8_t i = 0; i < SOCKBUDGET_OWNER_COUNT; i++)
+            {
+                if(i != owner && used[i] > reserved[i] && evict_cbs[i] != NULL)
+                {
+                    victim = i;
+                    break;
+                }
+            }
+        }
+    }
+
+    if(granted) used[owner]++;
+
+    xSemaphoreGive(x_mutex);
+
+    if(victim >= 0)
+    {
+        //Eviction is asynchronous, the budget is overcommitted until the victim releases its socket
+        if(evict_cbs[victim]() == ESP_OK)
+        {
+            ESP_LOGI(TAG, "Evicting idle %s socket for new %s socket", owner_names[victim], owner_names[owner]);
+            xSemaphoreTake(x_mutex, portMAX_DELAY);
+            used[owner]++;
+            xSemaphoreGive(x_mutex);
+            granted = true;
+        }
+    }
+
+    if(!granted)
+    {
+        ESP_LOGW(TAG, "No socket available for %s", owner_names[owner]);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/**
+ * Returns a socket of @param owner to the budget
+ */
+void sockbudget_release(sockbudget_owner_t owner)
+{
+    if(owner >= SOCKBUDGET_OWNER_COUNT || x_mutex == NULL) return;
+
+    xSemaphoreTake(x_mutex, portMAX_DELAY);
+    if(used[owner]) used[owner]--;
+    xSemaphoreGive(x_mutex);
+}
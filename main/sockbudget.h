@@ -0,0 +1,34 @@
+#ifndef NET_SOCKBUDGET_H
+#define NET_SOCKBUDGET_H
+
+#include "esp_system.h"
+
+/**
+ * Shared budget of client sockets for the webserver and the eventsource
+ *
+ * Every server reserves a number of sockets that are always available to it.
+ * The rest of the budget is shared. If the budget is exhausted, a server that is below its reservation
+ * makes room by evicting the least recently used idle socket of a server that exceeds its reservation.
+ */
+
+typedef enum {
+    SOCKBUDGET_HTTP = 0,
+    SOCKBUDGET_SSE,
+    SOCKBUDGET_OWNER_COUNT
+} sockbudget_owner_t;
+
+//Starts closing an idle socket of the owner, returns ESP_OK if a socket is going to be released
+typedef esp_err_t (*sockbudget_evict_cb_t) (void);
+
+void sockbudget_init(void);
+
+void sockbudget_set_total(uint8_t total);
+void sockbudget_set_reserved(sockbudget_owner_t owner, uint8_t reserved);
+void sockbudget_set_evict_cb(sockbudget_owner_t owner, sockbudget_evict_cb_t cb);
+
+uint8_t sockbudget_get_limit(sockbudget_owner_t owner);
+
+esp_err_t sockbudget_acquire(sockbudget_owner_t owner);
+void sockbudget_release(sockbudget_owner_t owner);
+
+#endif
@@ -0,0 +1,85 @@
+#include "sse.h"
+
+#include <string.h>
+
+static const char id_header[] = "id: ";
+static const char event_header[] = "event: ";
+static const char data_header[] = "data: ";
+
+/**
+ * Writes the decimal representation of @param val without terminator
+ * @return number of chars written (at most 10)
+ */
+size_t sse_format_uint(char* buf, unsigned int val)
+{
+    char digits[10];
+    size_t n = 0;
+    do {
+        digits[n++] = '0' + (val % 10);
+        val /= 10;
+    } while(val);
+    for(size_t i = 0; i < n; i++)
+    {
+        buf[i] = digits[n - i - 1];
+    }
+    return n;
+}
+
+static size_t format_field(char* buf, const char* name, size_t name_len, const char* value, size_t value_len)
+{
+    memcpy(buf, name, name_len);
+    memcpy(buf + name_len, value, value_len);
+    buf[name_len + value_len] = '\n';
+    return name_len + value_len + 1;
+}
+
+/**
+ * Writes the header lines of an event into @param buf and opens the data field if requested
+ * @param size of buf, space for the trailer has to be accounted for by the caller
+ * @param id (use -1 to not write id header)
+ * @param event (use NULL to not write event header)
+ * @return length of the header or 0 if it doesn't fit into buf
+ */
+size_t sse_format_header(char* buf, size_t size, int id, const char* event, bool data_line)
+{
+    size_t event_len = (event != NULL) ? strlen(event) : 0;
+
+    //Worst case: 10 digit id and every header present
+    size_t max_len = sizeof(id_header) + 10 + sizeof(event_header) + event_len + sizeof(data_header);
+    if(max_len > size) return 0;
+
+    size_t len = 0;
+
+    if(id >= 0)
+    {
+        memcpy(buf, id_header, sizeof(id_header) - 1);
+        len += sizeof(id_header) - 1;
+        len += sse_format_uint(buf + len, id);
+        buf[len++] = '\n';
+    }
+
+    if(event != NULL)
+    {
+        len += format_field(buf + len, event_header, sizeof(event_header) - 1, event, event_len);
+    }
+
+    if(data_line)
+    {
+        memcpy(buf + len, data_header, sizeof(data_header) - 1);
+        len += sizeof(data_header) - 1;
+    }
+
+    return len;
+}
+
+/**
+ * Terminates the data field (if opened) and the event
+ * @return number of chars written (at most SSE_TRAILER_LEN)
+ */
+size_t sse_format_trailer(char* buf, bool data_line)
+{
+    size_t len = 0;
+    if(data_line) buf[len++] = '\n';
+    buf[len++] = '\n';
+    return len;
+}
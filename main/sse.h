@@ -0,0 +1,19 @@
+#ifndef NET_SSE_H
+#define NET_SSE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Encoder for the HTML5 Server-Sent-Events wire format
+ * Doesn't depend on ESP-IDF, doesn't allocate and is safe to call from an ISR
+ */
+
+//Length of the line and frame terminators appended after the data field
+#define SSE_TRAILER_LEN 2
+
+size_t sse_format_uint(char* buf, unsigned int val);
+size_t sse_format_header(char* buf, size_t size, int id, const char* event, bool data_line);
+size_t sse_format_trailer(char* buf, bool data_line);
+
+#endif
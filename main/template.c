@@ -0,0 +1,38 @@
+#include "template.h"
+
+#include <string.h>
+
+/**
+ * Renders one chunk of a templated file.
+ * Text between placeholders is passed to emit, every placeholder is replaced by a call to substitute.
+ * Call repeatedly for consecutive chunks of the same file to keep placeholder indices counting up.
+ * @return 0 on success or the first non-zero value returned by a sink
+ */
+int template_render_chunk(template_renderer_t* renderer, const char* chunk, size_t len)
+{
+    const char* chunk_after = chunk + len;
+    const char* part = chunk;
+    int ret;
+
+    while(part < chunk_after)
+    {
+        const char* temp_indicator = memchr(part, renderer->placeholder, chunk_after - part);
+        if(!temp_indicator) break;
+
+        if(temp_indicator > part)
+        {
+            ret = renderer->emit(renderer->ctx, part, temp_indicator - part);
+            if(ret) return ret;
+        }
+        ret = renderer->substitute(renderer->ctx, renderer->index);
+        if(ret) return ret;
+        renderer->index++;
+        part = temp_indicator + 1;
+    }
+
+    if(part < chunk_after)
+    {
+        return renderer->emit(renderer->ctx, part, chunk_after - part);
+    }
+    return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef NET_TEMPLATE_H
+#define NET_TEMPLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Splits text at placeholder chars and hands the parts to user defined sinks
+ * Doesn't depend on ESP-IDF and doesn't allocate
+ */
+
+//Sinks return 0 on success, anything else aborts rendering
+typedef int (*template_emit_fn_t) (void* ctx, const char* buf, size_t len);
+typedef int (*template_placeholder_fn_t) (void* ctx, uint8_t index);
+
+typedef struct {
+    char placeholder;
+    template_emit_fn_t emit;
+    template_placeholder_fn_t substitute;
+    void* ctx;
+    uint8_t index;      //Index of the next placeholder, carried across chunks
+} template_renderer_t;
+
+int template_render_chunk(template_renderer_t* renderer, const char* chunk, size_t len);
+
+#endif
@@ -5,6 +5,7 @@
 #include <sys/unistd.h>
 #include <sys/stat.h>
 #include <sys/param.h>
+#include <time.h>
 #include <dirent.h>
 #include "esp_err.h"
 #include "esp_spiffs.h"
@@ -13,38 +14,223 @@
 #include <esp_log.h>
 #include <esp_system.h>
 #include <nvs_flash.h>
+#include <nvs.h>
 #include <sys/param.h>
 #include "tcpip_adapter.h"
 #include <sys/socket.h>
 
 #include <esp_http_server.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
 
 #include "defutil.h"
+#include "template.h"
+#include "sockbudget.h"
+#include "bootprof.h"
+#include "mempool.h"
 
 #define WEBSERVER_MAX_PATH_SIZE (ESP_VFS_PATH_MAX + CONFIG_SPIFFS_OBJ_NAME_LEN)
 #define WEBSERVER_TEMP_BUFSIZE  4096
+#define WEBSERVER_HDR_VALUE_SIZE 64
 
 //Currently only ASCII chars supported! wchar_t breaks memchr :(
 #define WEBSERVER_TEMPLATE_PLACEHOLDER '$'
 
+//Keep-alive connections without a request for this long may be evicted in favor of EventSource clients
+#define WEBSERVER_IDLE_EVICT_ms 1000
+#define WEBSERVER_MAX_SOCKETS CONFIG_LWIP_MAX_SOCKETS
+
 #define WEBSERVER_API_SUBSTRING "/api/"
 #define WEBSERVER_API_ENDPOINT "/api/*"
+#define WEBSERVER_API_BATCH_ENDPOINT "/api/batch"
+#define WEBSERVER_BATCH_RESP_BUFSIZE 256
+#define WEBSERVER_RECV_RETRIES 3
+//PUT or POST /fs/<path> replaces <path> on the filesystem. There is no authentication, set with CONFIG_WEBIF_UPLOAD
+#ifdef CONFIG_WEBIF_UPLOAD
+#define WEBSERVER_UPLOAD_SUPPORT 1
+#else
+#define WEBSERVER_UPLOAD_SUPPORT 0
+#endif
+#define WEBSERVER_UPLOAD_ENDPOINT "/fs/*"
+#define WEBSERVER_UPLOAD_SUBSTRING "/fs"
+//Appended to the target while the body is received and once it is complete
+#define WEBSERVER_UPLOAD_TEMP_SUFFIX "~part"
+#define WEBSERVER_UPLOAD_DONE_SUFFIX "~new"
+//Set once the filesystem that is mounted in the background during boot is ready
+#define WEBSERVER_FS_READY_BIT BIT0
+#define WEBSERVER_FS_TASK_STACK 4096
+
+//Rendered output of templated pages is kept in a few slots, larger pages are always streamed
+#define WEBSERVER_PAGE_CACHE_SLOTS 2
+#define WEBSERVER_PAGE_CACHE_SLOT_SIZE 4096
+//Value of the Link header with preload hints of a templated page, generated by tools/build_assets.py
+#define WEBSERVER_PRELOAD_SUFFIX ".preload"
+#define WEBSERVER_PRELOAD_SIZE 256
 
 static const char* TAG = "NET/WEBSERVER";
 
 typedef struct {
     char temp_buf[WEBSERVER_TEMP_BUFSIZE];
+    char batch_resp_buf[WEBSERVER_BATCH_RESP_BUFSIZE];
+    char page_cache_buf[WEBSERVER_PAGE_CACHE_SLOTS][WEBSERVER_PAGE_CACHE_SLOT_SIZE];
 } server_data_t;
 
+/**
+ * Rendered templated page. Content is valid as long as the versions it was rendered with are current,
+ * see webserver_template_bump_version
+ */
+typedef struct {
+    char filename[WEBSERVER_MAX_PATH_SIZE + 1];
+    unsigned int version;           //Data version of this page
+    unsigned int rendered_version;
+    unsigned int rendered_global;
+    size_t len;
+    bool valid;
+    TickType_t last_used;
+    char preload[WEBSERVER_PRELOAD_SIZE];   //Only used by the httpd task, kept while the page is sent
+} page_cache_entry_t;
+
 
 static server_data_t* server_data = NULL;
 static httpd_handle_t http_server;
+static EventGroupHandle_t fs_event_group = NULL;
+
+#if MEMPOOL_STATIC
+static server_data_t server_data_mem;
+static StaticEventGroup_t fs_event_group_mem;
+static StackType_t fs_task_stack[WEBSERVER_FS_TASK_STACK];
+static StaticTask_t fs_task_mem;
+#endif
+
+//Entries are only filled and read by the httpd task, versions are bumped from any task
+static page_cache_entry_t page_cache[WEBSERVER_PAGE_CACHE_SLOTS];
+static unsigned int page_cache_global_version = 0;
+static portMUX_TYPE page_cache_mux = portMUX_INITIALIZER_UNLOCKED;
+
+//Part of every ETag, so files replaced by an upload never match a validator of their old content.
+//Kept in NVS, SPIFFS mtime is relative to boot and can't tell contents of different boots apart
+#define WEBSERVER_NVS_NAMESPACE "webserver"
+#define WEBSERVER_NVS_FS_GENERATION "fs_gen"
+static uint32_t fs_generation = 0;
+
+static mempool_stat_t server_data_pool;
+static mempool_stat_t socks_pool;
 
 static web_template_cb_t template_cb = NULL;
+//Set by webserver_set_cached_template_cb, a callback may only write through webserver_template_send then
+static bool template_cached = false;
 static web_api_cb_t api_cb = NULL;
 
 static const char* BASE_PATH = "/spiffs";
 
+//Open client sockets in the order of their last activity, used for LRU eviction
+typedef struct {
+    int fd;
+    TickType_t last_active;
+    bool evicting;
+} http_sock_t;
+
+static http_sock_t socks[WEBSERVER_MAX_SOCKETS];
+static portMUX_TYPE socks_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static esp_err_t http_open_fn(httpd_handle_t hd, int sockfd)
+{
+    if(sockbudget_acquire(SOCKBUDGET_HTTP) != ESP_OK) return ESP_FAIL;
+
+    portENTER_CRITICAL(&socks_mux);
+    for(uint8_t i = 0; i < WEBSERVER_MAX_SOCKETS; i++)
+    {
+        if(socks[i].fd < 0)
+        {
+            socks[i].fd = sockfd;
+            socks[i].last_active = xTaskGetTickCount();
+            socks[i].evicting = false;
+            mempool_take(&socks_pool);
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&socks_mux);
+    return ESP_OK;
+}
+
+static void http_close_fn(httpd_handle_t hd, int sockfd)
+{
+    bool tracked = false;
+
+    portENTER_CRITICAL(&socks_mux);
+    for(uint8_t i = 0; i < WEBSERVER_MAX_SOCKETS; i++)
+    {
+        if(socks[i].fd == sockfd)
+        {
+            socks[i].fd = -1;
+            tracked = true;
+            mempool_give(&socks_pool);
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&socks_mux);
+
+    //Sockets rejected by http_open_fn are closed here as well, but never were part of the budget
+    if(tracked) sockbudget_release(SOCKBUDGET_HTTP);
+    close(sockfd);
+}
+
+static void http_touch(httpd_req_t* req)
+{
+    int sockfd = httpd_req_to_sockfd(req);
+
+    portENTER_CRITICAL(&socks_mux);
+    for(uint8_t i = 0; i < WEBSERVER_MAX_SOCKETS; i++)
+    {
+        if(socks[i].fd == sockfd)
+        {
+            socks[i].last_active = xTaskGetTickCount();
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&socks_mux);
+}
+
+//Closes the least recently used keep-alive connection that has been idle for at least WEBSERVER_IDLE_EVICT_ms
+static esp_err_t http_evict_idle(void)
+{
+    TickType_t now = xTaskGetTickCount();
+    int victim = -1;
+    TickType_t victim_idle = 0;
+
+    portENTER_CRITICAL(&socks_mux);
+    for(uint8_t i = 0; i < WEBSERVER_MAX_SOCKETS; i++)
+    {
+        if(socks[i].fd < 0 || socks[i].evicting) continue;
+        TickType_t idle = now - socks[i].last_active;
+        if(idle >= (WEBSERVER_IDLE_EVICT_ms/portTICK_PERIOD_MS) && idle >= victim_idle)
+        {
+            victim = i;
+            victim_idle = idle;
+        }
+    }
+    int fd = -1;
+    if(victim >= 0)
+    {
+        socks[victim].evicting = true;
+        fd = socks[victim].fd;
+    }
+    portEXIT_CRITICAL(&socks_mux);
+
+    if(fd < 0) return ESP_FAIL;
+    esp_err_t ret = httpd_sess_trigger_close(http_server, fd);
+    if(ret != ESP_OK)
+    {
+        //The socket stays open, so it has to remain a candidate and the budget must not count the eviction
+        portENTER_CRITICAL(&socks_mux);
+        if(socks[victim].fd == fd) socks[victim].evicting = false;
+        portEXIT_CRITICAL(&socks_mux);
+        ESP_LOGW(TAG, "Failed to evict socket %d: %d", fd, ret);
+    }
+    return ret;
+}
+
 static esp_err_t redirect_to_index(httpd_req_t* req)
 {
     httpd_resp_set_status(req, "307 Temporary Redirect");
@@ -53,25 +239,178 @@ static esp_err_t redirect_to_index(httpd_req_t* req)
     return httpd_resp_send(req, NULL, 0);
 }
 
-static esp_err_t set_content_type_from_file(httpd_req_t* req, const char* filename)
+static const char* content_type_from_file(const char* filename)
 {
     if(ENDS_WITH(filename, ".html"))
     {
-        return httpd_resp_set_type(req, "text/html");
+        return "text/html";
     }
     else if(ENDS_WITH(filename, ".js"))
     {
-        return httpd_resp_set_type(req, "text/javascript");
+        return "text/javascript";
     }
     else if(ENDS_WITH(filename, ".css"))
     {
-        return httpd_resp_set_type(req, "text/css");
+        return "text/css";
+    }
+    return "text/plain";
+}
+
+static esp_err_t set_content_type_from_file(httpd_req_t* req, const char* filename)
+{
+    return httpd_resp_set_type(req, content_type_from_file(filename));
+}
+
+//Sends the cached page if it was rendered with the current data versions
+static esp_err_t page_cache_send(httpd_req_t* req, const char* filename)
+{
+    int slot = -1;
+    portENTER_CRITICAL(&page_cache_mux);
+    for(uint8_t i = 0; i < WEBSERVER_PAGE_CACHE_SLOTS; i++)
+    {
+        page_cache_entry_t* entry = &page_cache[i];
+        if(entry->valid && !strcmp(entry->filename, filename)
+                && entry->rendered_version == entry->version && entry->rendered_global == page_cache_global_version)
+        {
+            entry->last_used = xTaskGetTickCount();
+            slot = i;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&page_cache_mux);
+    if(slot < 0) return ESP_ERR_NOT_FOUND;
+
+    //Only the httpd task writes the slot, a version bump meanwhile just makes the next request render again
+    if(page_cache[slot].preload[0]) httpd_resp_set_hdr(req, "Link", page_cache[slot].preload);
+    ESP_LOGI(TAG, "Sent cached page: %s", filename);
+    return httpd_resp_send(req, ((server_data_t*)(req->user_ctx))->page_cache_buf[slot], page_cache[slot].len);
+}
+
+//Picks the slot for rendering @param filename, preferring its previous slot and then the least recently used one
+static int page_cache_claim(const char* filename)
+{
+    int slot = -1;
+    portENTER_CRITICAL(&page_cache_mux);
+    for(uint8_t i = 0; i < WEBSERVER_PAGE_CACHE_SLOTS; i++)
+    {
+        if(!strcmp(page_cache[i].filename, filename))
+        {
+            slot = i;
+            break;
+        }
+        if(slot < 0 || (page_cache[slot].valid && (!page_cache[i].valid || page_cache[i].last_used < page_cache[slot].last_used))) slot = i;
+    }
+
+    page_cache_entry_t* entry = &page_cache[slot];
+    if(strcmp(entry->filename, filename))
+    {
+        strcpy(entry->filename, filename);
+        entry->version = 0;
+    }
+    //Bumps during rendering are detected by the next request
+    entry->rendered_version = entry->version;
+    entry->rendered_global = page_cache_global_version;
+    entry->valid = false;
+    entry->len = 0;
+    portEXIT_CRITICAL(&page_cache_mux);
+    return slot;
+}
+
+static void page_cache_store(int slot, size_t len)
+{
+    portENTER_CRITICAL(&page_cache_mux);
+    page_cache[slot].len = len;
+    page_cache[slot].valid = true;
+    page_cache[slot].last_used = xTaskGetTickCount();
+    portEXIT_CRITICAL(&page_cache_mux);
+}
+
+static void page_cache_release(int slot)
+{
+    portENTER_CRITICAL(&page_cache_mux);
+    page_cache[slot].filename[0] = 0;
+    page_cache[slot].valid = false;
+    portEXIT_CRITICAL(&page_cache_mux);
+}
+
+//Reads the preload hints of the assets @param filename references into @param preload
+static void page_read_preload(const char* filename, char* preload, size_t size)
+{
+    char name[WEBSERVER_MAX_PATH_SIZE + sizeof(WEBSERVER_PRELOAD_SUFFIX)];
+    snprintf(name, sizeof(name), "%s" WEBSERVER_PRELOAD_SUFFIX, filename);
+    preload[0] = 0;
+    FILE* fd = fopen(name, "r");
+    if(fd == NULL) return;
+    size_t len = fread(preload, 1, size - 1, fd);
+    fclose(fd);
+    while(len && (preload[len - 1] == '\n' || preload[len - 1] == '\r')) len--;
+    preload[len] = 0;
+}
+
+typedef struct {
+    httpd_req_t* req;
+    const char* filename;
+    int slot;       //Cache slot the page is rendered into, -1 once it is streamed to the client
+    size_t len;
+} template_ctx_t;
+
+//Page being rendered by the httpd task, target of webserver_template_send
+static template_ctx_t* template_render = NULL;
+
+//Gives up caching the page being rendered and sends what was rendered so far
+static esp_err_t template_stop_caching(template_ctx_t* ctx)
+{
+    int slot = ctx->slot;
+    if(slot < 0) return ESP_OK;
+    ctx->slot = -1;
+    page_cache_release(slot);
+    if(!ctx->len) return ESP_OK;
+    return httpd_resp_send_chunk(ctx->req, ((server_data_t*)(ctx->req->user_ctx))->page_cache_buf[slot], ctx->len);
+}
+
+static esp_err_t template_write(template_ctx_t* ctx, const char* buf, size_t len)
+{
+    if(ctx->slot >= 0)
+    {
+        if(ctx->len + len <= WEBSERVER_PAGE_CACHE_SLOT_SIZE)
+        {
+            memcpy(((server_data_t*)(ctx->req->user_ctx))->page_cache_buf[ctx->slot] + ctx->len, buf, len);
+            ctx->len += len;
+            return ESP_OK;
+        }
+        //Page is too large for the cache, stream the rest
+        if(template_stop_caching(ctx) != ESP_OK) return ESP_FAIL;
     }
-    return httpd_resp_set_type(req, "text/plain");
+    return httpd_resp_send_chunk(ctx->req, buf, len);
+}
+
+static int template_emit(void* ctx, const char* buf, size_t len)
+{
+    return template_write((template_ctx_t*)ctx, buf, len);
 }
 
+static int template_substitute(void* ctx, uint8_t index)
+{
+    if(template_cb == NULL) return ESP_OK;
+    template_ctx_t* tctx = (template_ctx_t*)ctx;
+    return template_cb(tctx->req, tctx->filename, index);
+}
+
+/**
+ * Sends a templated page. With a cached template callback the rendered output is cached unless it is too large
+ * or the callback declared itself volatile, so pages whose data didn't change are sent from memory with Content-Length
+ */
 static esp_err_t http_send_file_templated(httpd_req_t* req, const char* filename)
 {
+    set_content_type_from_file(req, filename);
+    //Callbacks set with webserver_set_template_cb may send chunks directly, their pages are always streamed
+    bool cached = template_cb == NULL || template_cached;
+    if(cached)
+    {
+        esp_err_t ret = page_cache_send(req, filename);
+        if(ret != ESP_ERR_NOT_FOUND) return ret;
+    }
+
     FILE* fd = fopen(filename, "r");
     if(fd == 0)
     {
@@ -80,13 +419,29 @@ static esp_err_t http_send_file_templated(httpd_req_t* req, const char* filename
         return ESP_FAIL;
     }
 
-    set_content_type_from_file(req, filename);
-
     size_t chunksize;
     char* chunk = ((server_data_t*)(req->user_ctx))->temp_buf;
-    char* chunk_after;
 
-    uint8_t template_index = 0;
+    template_ctx_t ctx = {
+            .req = req,
+            .filename = filename,
+            .slot = cached ? page_cache_claim(filename) : -1,
+            .len = 0
+    };
+    template_renderer_t renderer = {
+            .placeholder = WEBSERVER_TEMPLATE_PLACEHOLDER,
+            .emit = template_emit,
+            .substitute = template_substitute,
+            .ctx = &ctx,
+            .index = 0
+    };
+    template_render = &ctx;
+
+    //Lets the browser fetch external assets while the page is still loading
+    char preload_buf[WEBSERVER_PRELOAD_SIZE];
+    char* preload = (ctx.slot >= 0) ? page_cache[ctx.slot].preload : preload_buf;
+    page_read_preload(filename, preload, WEBSERVER_PRELOAD_SIZE);
+    if(preload[0]) httpd_resp_set_hdr(req, "Link", preload);
 
     while(true)
     {
@@ -95,49 +450,163 @@ static esp_err_t http_send_file_templated(httpd_req_t* req, const char* filename
 
         //Search for placeholders and split the chunks at the placeholder positions.
         //After splitting the chunk control is handed to the user defined callback function
-
-        chunk_after = chunk + chunksize;
-        size_t len_left = chunksize;
-        char* part = chunk;
-        size_t part_len;
-        char* temp_indicator = NULL;
-
-        do {
-            temp_indicator = memchr(part, WEBSERVER_TEMPLATE_PLACEHOLDER, len_left);
-            if(temp_indicator) {
-                (*temp_indicator) = 0;
-                part_len = temp_indicator-part;
-                if(part_len)
-                {
-                    if(httpd_resp_send_chunk(req, part, part_len) != ESP_OK) goto fail;
-                }
-                if(template_cb(req, filename, template_index) != ESP_OK) goto fail;
-                template_index++;
-                part = temp_indicator + 1;
-                len_left = chunk_after-part;
-            }
-        } while (temp_indicator && part < chunk_after);
-
-        if(len_left)
-        {
-            if(httpd_resp_send_chunk(req, part, len_left) != ESP_OK) goto fail;
-        }
+        if(template_render_chunk(&renderer, chunk, chunksize) != ESP_OK) goto fail;
     }
 
     fclose(fd);
+    template_render = NULL;
+    if(ctx.slot >= 0)
+    {
+        page_cache_store(ctx.slot, ctx.len);
+        ESP_LOGI(TAG, "Rendered and cached templated file: %s", filename);
+        return httpd_resp_send(req, ((server_data_t*)(req->user_ctx))->page_cache_buf[ctx.slot], ctx.len);
+    }
     ESP_LOGI(TAG, "Sent templated file: %s", filename);
     return httpd_resp_send_chunk(req, NULL, 0);
 
     fail:
     fclose(fd);
+    template_render = NULL;
     ESP_LOGE(TAG, "Failed to send templated file: %s", filename);
+    if(ctx.slot >= 0)
+    {
+        //Nothing was sent yet
+        page_cache_release(ctx.slot);
+        return httpd_resp_send_500(req);
+    }
     httpd_resp_send_chunk(req, NULL, 0);
     httpd_resp_send_500(req);
     return ESP_FAIL;
 }
 
-static esp_err_t http_send_file_chunked(httpd_req_t* req, const char* filename)
+static esp_err_t http_send_all(httpd_req_t* req, const char* buf, size_t len)
+{
+    while(len)
+    {
+        int sent = httpd_send(req, buf, len);
+        if(sent < 0) return ESP_FAIL;
+        buf += sent;
+        len -= sent;
+    }
+    return ESP_OK;
+}
+
+/**
+ * Parses a single range of the form "bytes=first-last", "bytes=first-" or "bytes=-suffix"
+ * @return ESP_ERR_NOT_FOUND if the whole file should be sent, ESP_ERR_INVALID_SIZE if the range is unsatisfiable
+ */
+//Continues with the generation of the previous boot. Requires NVS to be initialized before webserver_init
+static void fs_generation_load(void)
+{
+    nvs_handle_t nvs;
+    if(nvs_open(WEBSERVER_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) return;
+    nvs_get_u32(nvs, WEBSERVER_NVS_FS_GENERATION, &fs_generation);
+    nvs_close(nvs);
+}
+
+#if WEBSERVER_UPLOAD_SUPPORT
+static void fs_generation_bump(void)
+{
+    fs_generation++;
+    nvs_handle_t nvs;
+    esp_err_t ret = nvs_open(WEBSERVER_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if(ret == ESP_OK)
+    {
+        ret = nvs_set_u32(nvs, WEBSERVER_NVS_FS_GENERATION, fs_generation);
+        if(ret == ESP_OK) ret = nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    if(ret != ESP_OK) ESP_LOGE(TAG, "Failed to store filesystem generation: %d", ret);
+}
+#endif
+
+static esp_err_t parse_range(httpd_req_t* req, const char* etag, const char* last_modified, size_t size, size_t* first, size_t* last)
 {
+    char value[WEBSERVER_HDR_VALUE_SIZE];
+
+    if(httpd_req_get_hdr_value_str(req, "Range", value, sizeof(value)) != ESP_OK) return ESP_ERR_NOT_FOUND;
+
+    //Only honor the range if the client's copy is still current
+    char validator[WEBSERVER_HDR_VALUE_SIZE];
+    if(httpd_req_get_hdr_value_str(req, "If-Range", validator, sizeof(validator)) == ESP_OK)
+    {
+        if(strcmp(validator, etag) && (last_modified[0] == 0 || strcmp(validator, last_modified)))
+        {
+            return ESP_ERR_NOT_FOUND;
+        }
+    }
+
+    //Multiple ranges are not supported, the whole file is a valid response to them
+    if(!STARTS_WITH(value, "bytes=") || strchr(value, ',')) return ESP_ERR_NOT_FOUND;
+
+    char* spec = value + strlen("bytes=");
+    char* end;
+    if(*spec == '-')
+    {
+        unsigned long suffix = strtoul(spec + 1, &end, 10);
+        if(end == spec + 1 || *end) return ESP_ERR_NOT_FOUND;
+        if(suffix == 0 || size == 0) return ESP_ERR_INVALID_SIZE;
+        *first = (suffix < size) ? size - suffix : 0;
+        *last = size - 1;
+        return ESP_OK;
+    }
+
+    unsigned long start = strtoul(spec, &end, 10);
+    if(end == spec || *end != '-') return ESP_ERR_NOT_FOUND;
+    if(start >= size) return ESP_ERR_INVALID_SIZE;
+    *first = start;
+
+    spec = end + 1;
+    if(*spec == 0)
+    {
+        *last = size - 1;
+        return ESP_OK;
+    }
+    unsigned long stop = strtoul(spec, &end, 10);
+    if(*end || stop < start) return ESP_ERR_NOT_FOUND;
+    *last = MIN(stop, size - 1);
+    return ESP_OK;
+}
+
+/**
+ * Sends a static file with Content-Length and support for single byte ranges
+ * The response is written directly to the socket as httpd only supports chunked streaming
+ */
+static esp_err_t http_send_file(httpd_req_t* req, const char* filename)
+{
+    struct stat file_stat;
+    if(stat(filename, &file_stat) == -1)
+    {
+        ESP_LOGE(TAG, "Failed to stat file: %s", filename);
+        return httpd_resp_send_404(req);
+    }
+    size_t size = file_stat.st_size;
+
+    char etag[32];
+    snprintf(etag, sizeof(etag), "\"%lx-%lx-%x\"", (unsigned long)size, (unsigned long)file_stat.st_mtime, (unsigned)fs_generation);
+    //SPIFFS only tracks modification times with CONFIG_SPIFFS_USE_MTIME
+    char last_modified[32] = {0};
+    if(file_stat.st_mtime > 0)
+    {
+        struct tm tm;
+        gmtime_r(&file_stat.st_mtime, &tm);
+        strftime(last_modified, sizeof(last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    }
+
+    size_t first = 0;
+    size_t last = size - 1;
+    esp_err_t range = parse_range(req, etag, last_modified, size, &first, &last);
+    if(range == ESP_ERR_INVALID_SIZE)
+    {
+        char content_range[32];
+        snprintf(content_range, sizeof(content_range), "bytes */%lu", (unsigned long)size);
+        httpd_resp_set_status(req, "416 Range Not Satisfiable");
+        httpd_resp_set_hdr(req, "Content-Range", content_range);
+        return httpd_resp_send(req, NULL, 0);
+    }
+    bool partial = (range == ESP_OK);
+    size_t len = size ? (last - first + 1) : 0;
+
     FILE* fd = fopen(filename, "r");
     if(fd == 0)
     {
@@ -145,30 +614,61 @@ static esp_err_t http_send_file_chunked(httpd_req_t* req, const char* filename)
         ESP_LOGE(TAG, "Failed to open file: %s", filename);
         return ESP_FAIL;
     }
+    if(first && fseek(fd, first, SEEK_SET))
+    {
+        fclose(fd);
+        httpd_resp_send_500(req);
+        ESP_LOGE(TAG, "Failed to seek in file: %s", filename);
+        return ESP_FAIL;
+    }
 
-    set_content_type_from_file(req, filename);
-
-    size_t chunksize;
     char* chunk = ((server_data_t*)(req->user_ctx))->temp_buf;
 
-    while(true)
+    int hdr_len = snprintf(chunk, WEBSERVER_TEMP_BUFSIZE,
+            "HTTP/1.1 %s\r\n"
+            "Content-Type: %s\r\n"
+            "Content-Length: %lu\r\n"
+            "Accept-Ranges: bytes\r\n"
+            "ETag: %s\r\n",
+            partial ? "206 Partial Content" : "200 OK",
+            content_type_from_file(filename),
+            (unsigned long)len,
+            etag);
+    if(partial)
     {
-        chunksize = fread(chunk, 1, WEBSERVER_TEMP_BUFSIZE,fd);
-        if(!chunksize) break;
+        hdr_len += snprintf(chunk + hdr_len, WEBSERVER_TEMP_BUFSIZE - hdr_len, "Content-Range: bytes %lu-%lu/%lu\r\n",
+                (unsigned long)first, (unsigned long)last, (unsigned long)size);
+    }
+    if(last_modified[0])
+    {
+        hdr_len += snprintf(chunk + hdr_len, WEBSERVER_TEMP_BUFSIZE - hdr_len, "Last-Modified: %s\r\n", last_modified);
+    }
+    //Circumvent cross origin block because the EventSource on PORT 8080 needs to be accessible
+    hdr_len += snprintf(chunk + hdr_len, WEBSERVER_TEMP_BUFSIZE - hdr_len,
+            "Access-Control-Allow-Origin: *\r\n"
+            "Access-Control-Expose-Headers: *\r\n"
+            "\r\n");
 
-        if(httpd_resp_send_chunk(req, chunk, chunksize) != ESP_OK)
-        {
-            ESP_LOGE(TAG, "Failed to send file: %s", filename);
-            fclose(fd);
-            httpd_resp_send_chunk(req, NULL, 0);
-            httpd_resp_send_500(req);
-            return ESP_FAIL;
-        }
+    if(http_send_all(req, chunk, hdr_len) != ESP_OK) goto fail;
 
+    size_t left = len;
+    while(left)
+    {
+        size_t chunksize = fread(chunk, 1, MIN(left, WEBSERVER_TEMP_BUFSIZE), fd);
+        if(!chunksize) goto fail;
+        if(http_send_all(req, chunk, chunksize) != ESP_OK) goto fail;
+        left -= chunksize;
     }
+
     fclose(fd);
-    ESP_LOGI(TAG, "Sent file: %s", filename);
-    return httpd_resp_send_chunk(req, NULL, 0);
+    ESP_LOGI(TAG, "Sent file: %s (%lu bytes)", filename, (unsigned long)len);
+    return ESP_OK;
+
+    fail:
+    //Headers are already sent, the only thing left to do is to drop the connection
+    fclose(fd);
+    ESP_LOGE(TAG, "Failed to send file: %s", filename);
+    return ESP_FAIL;
 }
 
 static esp_err_t filename_from_req(httpd_req_t* req, char* filename)
@@ -211,8 +711,17 @@ static esp_err_t filename_from_req(httpd_req_t* req, char* filename)
     return ESP_OK;
 }
 
+//Requests are answered with 503 until the mount finished, waiting would block the single httpd task
+static bool filesystem_ready(void)
+{
+    return (xEventGroupGetBits(fs_event_group) & WEBSERVER_FS_READY_BIT) != 0;
+}
+
 static esp_err_t http_get_handler(httpd_req_t* req)
 {
+    http_touch(req);
+    bootprof_mark_once("first_request");
+
     if(!strcmp(req->uri,"/"))
     {
         return redirect_to_index(req);
@@ -220,6 +729,13 @@ static esp_err_t http_get_handler(httpd_req_t* req)
 
     char filename[WEBSERVER_MAX_PATH_SIZE + 1] = {0};
 
+    if(!filesystem_ready())
+    {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
     /*
     //code gets own and remote ip of TCP connection used for the http request
     //not needed (yet)
@@ -247,7 +763,7 @@ static esp_err_t http_get_handler(httpd_req_t* req)
     if(ENDS_WITH(filename, ".html")){
         return http_send_file_templated(req, filename);
     } else {
-        return http_send_file_chunked(req, filename);
+        return http_send_file(req, filename);
     }
 }
 
@@ -255,6 +771,8 @@ static esp_err_t http_api_post_handler(httpd_req_t* req)
 {
     esp_err_t ret = ESP_OK;
 
+    http_touch(req);
+
     if(api_cb == NULL)
     {
         httpd_resp_sendstr(req, "API call not handled");
@@ -265,9 +783,7 @@ static esp_err_t http_api_post_handler(httpd_req_t* req)
         size_t substr_len = strlen(WEBSERVER_API_SUBSTRING);
         if(uri_len > substr_len)
         {
-            char call_name[(uri_len-substr_len+1)];
-            strcpy(call_name, req->uri+substr_len);
-            ret = api_cb(req, call_name);
+            ret = api_cb(req, req->uri + substr_len);
         }
         else
         {
@@ -286,6 +802,289 @@ static esp_err_t http_api_post_handler(httpd_req_t* req)
     return ret;
 }
 
+typedef struct {
+    httpd_req_t* req;
+    char* buf;
+    size_t len;
+} batch_resp_t;
+
+static esp_err_t batch_resp_flush(batch_resp_t* resp)
+{
+    if(!resp->len) return ESP_OK;
+    esp_err_t ret = httpd_resp_send_chunk(resp->req, resp->buf, resp->len);
+    resp->len = 0;
+    return ret;
+}
+
+static esp_err_t batch_exec(batch_resp_t* resp, char* call)
+{
+    size_t call_len = strlen(call);
+    if(call_len && call[call_len - 1] == '\r') call[--call_len] = 0;
+    if(!call_len) return ESP_OK;
+
+    const char* status = (api_cb(resp->req, call) == ESP_OK) ? "ok\n" : "failed\n";
+    size_t status_len = strlen(status);
+
+    if(resp->len + status_len > WEBSERVER_BATCH_RESP_BUFSIZE)
+    {
+        if(batch_resp_flush(resp) != ESP_OK) return ESP_FAIL;
+    }
+    memcpy(resp->buf + resp->len, status, status_len);
+    resp->len += status_len;
+    return ESP_OK;
+}
+
+/**
+ * Executes many API calls in one request.
+ * The body contains one call per line in the same form as the path after /api/, e.g. "name" or "name=arg".
+ * Calls are executed in order. The response contains one line per call with either "ok" or "failed".
+ * The API callback must not send a response itself for batched calls.
+ */
+static esp_err_t http_api_batch_handler(httpd_req_t* req)
+{
+    http_touch(req);
+
+    if(api_cb == NULL)
+    {
+        return httpd_resp_sendstr(req, "API call not handled");
+    }
+
+    server_data_t* data = (server_data_t*)(req->user_ctx);
+    //Keep one byte for terminating the last call
+    const size_t buf_size = WEBSERVER_TEMP_BUFSIZE - 1;
+    char* buf = data->temp_buf;
+    size_t buf_len = 0;
+    size_t remaining = req->content_len;
+    uint8_t retries = 0;
+
+    batch_resp_t resp = {
+            .req = req,
+            .buf = data->batch_resp_buf,
+            .len = 0
+    };
+
+    httpd_resp_set_type(req, "text/plain");
+
+    while(remaining || buf_len)
+    {
+        if(remaining && buf_len < buf_size)
+        {
+            int received = httpd_req_recv(req, buf + buf_len, MIN(remaining, buf_size - buf_len));
+            if(received == HTTPD_SOCK_ERR_TIMEOUT && ++retries <= WEBSERVER_RECV_RETRIES) continue;
+            if(received <= 0)
+            {
+                ESP_LOGE(TAG, "Failed to receive API batch");
+                goto fail;
+            }
+            retries = 0;
+            buf_len += received;
+            remaining -= received;
+        }
+
+        //Execute every complete line, the last call may end without a newline
+        char* start = buf;
+        char* end = buf + buf_len;
+        while(start < end)
+        {
+            char* sep = memchr(start, '\n', end - start);
+            if(sep == NULL)
+            {
+                if(remaining) break;
+                sep = end;
+            }
+            *sep = 0;
+            if(batch_exec(&resp, start) != ESP_OK) goto fail;
+            start = sep + 1;
+        }
+
+        if(start >= end)
+        {
+            buf_len = 0;
+        }
+        else
+        {
+            buf_len = end - start;
+            if(buf_len == buf_size)
+            {
+                ESP_LOGE(TAG, "API call in batch is too long");
+                goto fail;
+            }
+            memmove(buf, start, buf_len);
+        }
+    }
+
+    if(batch_resp_flush(&resp) != ESP_OK) goto fail;
+    return httpd_resp_send_chunk(req, NULL, 0);
+
+    fail:
+    //Status of the calls executed so far has been sent already
+    batch_resp_flush(&resp);
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_FAIL;
+}
+
+#if WEBSERVER_UPLOAD_SUPPORT
+
+//Receives the body into the temp file through the pooled I/O buffer
+static esp_err_t upload_receive(httpd_req_t* req, FILE* fd)
+{
+    char* buf = ((server_data_t*)(req->user_ctx))->temp_buf;
+    size_t remaining = req->content_len;
+    uint8_t retries = 0;
+
+    while(remaining)
+    {
+        int received = httpd_req_recv(req, buf, MIN(remaining, WEBSERVER_TEMP_BUFSIZE));
+        if(received == HTTPD_SOCK_ERR_TIMEOUT && ++retries <= WEBSERVER_RECV_RETRIES) continue;
+        if(received <= 0)
+        {
+            ESP_LOGE(TAG, "Failed to receive upload");
+            return ESP_ERR_TIMEOUT;
+        }
+        retries = 0;
+        if(fwrite(buf, 1, received, fd) != received)
+        {
+            ESP_LOGE(TAG, "Failed to write upload");
+            return ESP_FAIL;
+        }
+        remaining -= received;
+    }
+    return ESP_OK;
+}
+
+/**
+ * Streams the body of PUT/POST /fs/<path> to <path> on the filesystem.
+ * The body goes to a temp file first, which replaces the target only once it was received completely.
+ */
+static esp_err_t http_upload_handler(httpd_req_t* req)
+{
+    http_touch(req);
+
+    if(!filesystem_ready())
+    {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    char filename[WEBSERVER_MAX_PATH_SIZE + 1];
+    char temp_name[WEBSERVER_MAX_PATH_SIZE + sizeof(WEBSERVER_UPLOAD_TEMP_SUFFIX)];
+    char done_name[WEBSERVER_MAX_PATH_SIZE + sizeof(WEBSERVER_UPLOAD_DONE_SUFFIX)];
+    const char* path = req->uri + strlen(WEBSERVER_UPLOAD_SUBSTRING);
+    size_t path_len = strcspn(path, "?#");
+    if(path_len < 2 || path[path_len - 1] == '/' || strstr(path, "..") != NULL
+            || strlen(BASE_PATH) + path_len > WEBSERVER_MAX_PATH_SIZE)
+    {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid path");
+    }
+    snprintf(filename, sizeof(filename), "%s%.*s", BASE_PATH, (int)path_len, path);
+    snprintf(temp_name, sizeof(temp_name), "%s" WEBSERVER_UPLOAD_TEMP_SUFFIX, filename);
+    snprintf(done_name, sizeof(done_name), "%s" WEBSERVER_UPLOAD_DONE_SUFFIX, filename);
+
+    size_t total = 0;
+    size_t used = 0;
+    if(esp_spiffs_info(NULL, &total, &used) == ESP_OK && req->content_len > total - used)
+    {
+        ESP_LOGE(TAG, "Upload of %u bytes doesn't fit: %s", (unsigned)req->content_len, filename);
+        httpd_resp_set_status(req, "507 Insufficient Storage");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    FILE* fd = fopen(temp_name, "w");
+    if(fd == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create file: %s", temp_name);
+        return httpd_resp_send_500(req);
+    }
+    //Chunks are as large as the I/O buffer, another copy in a stdio buffer would only cost memory
+    setvbuf(fd, NULL, _IONBF, 0);
+
+    esp_err_t ret = upload_receive(req, fd);
+    if(fclose(fd) && ret == ESP_OK) ret = ESP_FAIL;
+    if(ret != ESP_OK)
+    {
+        remove(temp_name);
+        if(ret == ESP_ERR_TIMEOUT) return httpd_resp_send_err(req, HTTPD_408_REQ_TIMEOUT, NULL);
+        return httpd_resp_send_500(req);
+    }
+
+    //SPIFFS can't rename onto an existing file, so the target is removed right before.
+    //The complete body is marked first, so upload_recover can finish the swap after a power loss
+    //Before the swap, a reboot in between must not leave the new content with an old ETag
+    fs_generation_bump();
+
+    struct stat file_stat;
+    bool created = (stat(filename, &file_stat) == -1);
+    remove(done_name);
+    if(rename(temp_name, done_name))
+    {
+        ESP_LOGE(TAG, "Failed to replace %s", filename);
+        remove(temp_name);
+        return httpd_resp_send_500(req);
+    }
+    if(!created && remove(filename) && stat(filename, &file_stat) == 0)
+    {
+        //The old content is still in place
+        ESP_LOGE(TAG, "Failed to replace %s", filename);
+        remove(done_name);
+        return httpd_resp_send_500(req);
+    }
+    //The target is gone, <path>~new is the only copy of the content now and must be kept
+    if(rename(done_name, filename) && rename(done_name, filename))
+    {
+        ESP_LOGE(TAG, "Failed to replace %s, the upload is completed at the next mount", filename);
+        webserver_template_bump_version(filename);
+        return httpd_resp_send_500(req);
+    }
+
+    webserver_template_bump_version(filename);
+    ESP_LOGI(TAG, "Received file: %s (%u bytes)", filename, (unsigned)req->content_len);
+    //Preload hints are cached with their page
+    if(ENDS_WITH(filename, WEBSERVER_PRELOAD_SUFFIX))
+    {
+        filename[strlen(filename) - strlen(WEBSERVER_PRELOAD_SUFFIX)] = 0;
+        webserver_template_bump_version(filename);
+    }
+
+    httpd_resp_set_status(req, created ? "201 Created" : "204 No Content");
+    return httpd_resp_send(req, NULL, 0);
+}
+
+//Finishes uploads that were interrupted after the body was complete and drops all others
+static void upload_recover(void)
+{
+    DIR* dir = opendir(BASE_PATH);
+    if(dir == NULL) return;
+
+    char temp_name[WEBSERVER_MAX_PATH_SIZE + sizeof(WEBSERVER_UPLOAD_TEMP_SUFFIX)];
+    char filename[WEBSERVER_MAX_PATH_SIZE + 1];
+    struct dirent* entry;
+    while((entry = readdir(dir)) != NULL)
+    {
+        size_t len = strlen(entry->d_name);
+        snprintf(temp_name, sizeof(temp_name), "%s/%s", BASE_PATH, entry->d_name);
+        if(len > strlen(WEBSERVER_UPLOAD_TEMP_SUFFIX) && ENDS_WITH(entry->d_name, WEBSERVER_UPLOAD_TEMP_SUFFIX))
+        {
+            remove(temp_name);
+        }
+        else if(len > strlen(WEBSERVER_UPLOAD_DONE_SUFFIX) && ENDS_WITH(entry->d_name, WEBSERVER_UPLOAD_DONE_SUFFIX))
+        {
+            snprintf(filename, sizeof(filename), "%s/%.*s", BASE_PATH, (int)(len - strlen(WEBSERVER_UPLOAD_DONE_SUFFIX)), entry->d_name);
+            remove(filename);
+            if(rename(temp_name, filename))
+            {
+                //Kept for the next attempt, it may be the only copy
+                ESP_LOGE(TAG, "Failed to complete interrupted upload: %s", filename);
+                continue;
+            }
+            ESP_LOGW(TAG, "Completed interrupted upload: %s", filename);
+        }
+    }
+    closedir(dir);
+}
+
+#endif
+
 static void register_handlers(void) {
     httpd_uri_t get_handler = {
             .uri = "/*",
@@ -295,6 +1094,15 @@ static void register_handlers(void) {
     };
     httpd_register_uri_handler(http_server, &get_handler);
 
+    //Has to be registered before the generic API handler as handlers are matched in order
+    httpd_uri_t batch_handler = {
+            .uri = WEBSERVER_API_BATCH_ENDPOINT,
+            .method = HTTP_POST,
+            .handler = http_api_batch_handler,
+            .user_ctx = server_data
+    };
+    httpd_register_uri_handler(http_server, &batch_handler);
+
     httpd_uri_t post_handler = {
             .uri = WEBSERVER_API_ENDPOINT,
             .method = HTTP_POST,
@@ -302,10 +1110,23 @@ static void register_handlers(void) {
             .user_ctx = server_data
     };
     httpd_register_uri_handler(http_server, &post_handler);
+
+#if WEBSERVER_UPLOAD_SUPPORT
+    httpd_uri_t upload_handler = {
+            .uri = WEBSERVER_UPLOAD_ENDPOINT,
+            .method = HTTP_PUT,
+            .handler = http_upload_handler,
+            .user_ctx = server_data
+    };
+    httpd_register_uri_handler(http_server, &upload_handler);
+    upload_handler.method = HTTP_POST;
+    httpd_register_uri_handler(http_server, &upload_handler);
+#endif
 }
 
-void webserver_init_filesystem(void)
+static void init_filesystem(void)
 {
+    int64_t start = bootprof_now();
     ESP_LOGI(TAG, "Initializing SPIFFS...");
     esp_vfs_spiffs_conf_t conf = {
             .base_path = BASE_PATH,
@@ -316,27 +1137,66 @@ void webserver_init_filesystem(void)
 
     esp_err_t ret = esp_vfs_spiffs_register(&conf);
     ESP_ERROR_CHECK(ret);
+    bootprof_mark("spiffs_mount", start);
+    fs_generation_load();
+#if WEBSERVER_UPLOAD_SUPPORT
+    upload_recover();
+#endif
+    xEventGroupSetBits(fs_event_group, WEBSERVER_FS_READY_BIT);
+}
+
+//Mounting (and formatting on first boot) can take seconds, so it runs in parallel to the rest of the bring-up
+static void filesystem_task(void* param)
+{
+    init_filesystem();
+    vTaskDelete(NULL);
 }
 
 void webserver_init(void)
 {
     if(server_data != NULL) return;
 
+#if MEMPOOL_STATIC
+    server_data = &server_data_mem;
+#else
     server_data = calloc(1, sizeof(server_data_t));
+#endif
+    mempool_register(&server_data_pool, "webserver_data", sizeof(server_data_t), 1);
+    mempool_take(&server_data_pool);
+    mempool_register(&socks_pool, "webserver_sockets", sizeof(http_sock_t), WEBSERVER_MAX_SOCKETS);
+
+    for(uint8_t i = 0; i < WEBSERVER_MAX_SOCKETS; i++)
+    {
+        socks[i].fd = -1;
+    }
+    sockbudget_init();
+    sockbudget_set_evict_cb(SOCKBUDGET_HTTP, http_evict_idle);
 
-    webserver_init_filesystem();
+#if MEMPOOL_STATIC
+    fs_event_group = xEventGroupCreateStatic(&fs_event_group_mem);
+    xTaskCreateStatic(filesystem_task, "webserver_fs", WEBSERVER_FS_TASK_STACK, NULL, 5, fs_task_stack, &fs_task_mem);
+#else
+    fs_event_group = xEventGroupCreate();
+    xTaskCreate(filesystem_task, "webserver_fs", WEBSERVER_FS_TASK_STACK, NULL, 5, NULL);
+#endif
 }
 
 void webserver_start(void)
 {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.uri_match_fn = httpd_uri_match_wildcard;
-    config.max_open_sockets = 5;
+    //The socket budget decides which connections are kept, httpd only purges its own LRU connection when its limit is reached
+    config.max_open_sockets = sockbudget_get_limit(SOCKBUDGET_HTTP);
+    config.lru_purge_enable = true;
+    config.open_fn = http_open_fn;
+    config.close_fn = http_close_fn;
     ESP_LOGI(TAG, "Starting HTTP server");
 
+    int64_t start = bootprof_now();
     if(httpd_start(&http_server, &config) == ESP_OK)
     {
         register_handlers();
+        bootprof_mark("httpd_start", start);
     }
     else
     {
@@ -354,16 +1214,78 @@ void webserver_destroy(void)
 {
     if(server_data == NULL) return;
 
+#if !MEMPOOL_STATIC
     free(server_data);
+#endif
+    mempool_give(&server_data_pool);
     server_data = NULL;
 }
 
 /**
  * Sets callback which gets notified when a template needs to be processed
+ * The callback may send its output with httpd_resp_send_chunk, pages are streamed and never cached
  */
 void webserver_set_template_cb(web_template_cb_t cb)
 {
     template_cb = cb;
+    template_cached = false;
+}
+
+/**
+ * Same as webserver_set_template_cb, but rendered pages are cached until webserver_template_bump_version.
+ * The callback must write only through webserver_template_send, a direct httpd_resp_send_chunk would corrupt the response
+ */
+void webserver_set_cached_template_cb(web_template_cb_t cb)
+{
+    template_cb = cb;
+    template_cached = true;
+}
+
+/**
+ * Writes output of a template callback, either into the page cache or to the client
+ */
+esp_err_t webserver_template_send(httpd_req_t* req, const char* buf, size_t len)
+{
+    template_ctx_t* ctx = template_render;
+    if(ctx == NULL || ctx->req != req) return httpd_resp_send_chunk(req, buf, len);
+    return template_write(ctx, buf, len);
+}
+
+esp_err_t webserver_template_sendstr(httpd_req_t* req, const char* str)
+{
+    return webserver_template_send(req, str, strlen(str));
+}
+
+/**
+ * Called by a template callback whose output changes with every request, e.g. uptime.
+ * The page being rendered is streamed instead of cached
+ */
+esp_err_t webserver_template_volatile(httpd_req_t* req)
+{
+    template_ctx_t* ctx = template_render;
+    if(ctx == NULL || ctx->req != req) return ESP_OK;
+    return template_stop_caching(ctx);
+}
+
+/**
+ * Invalidates the cached page of @param filename (as passed to the template callback) or all pages if NULL.
+ * Call whenever data used by the template callback changed. Safe to call from any task
+ */
+void webserver_template_bump_version(const char* filename)
+{
+    portENTER_CRITICAL(&page_cache_mux);
+    if(filename == NULL)
+    {
+        page_cache_global_version++;
+    }
+    else
+    {
+        for(uint8_t i = 0; i < WEBSERVER_PAGE_CACHE_SLOTS; i++)
+        {
+            if(!strcmp(page_cache[i].filename, filename)) page_cache[i].version++;
+        }
+    }
+    portEXIT_CRITICAL(&page_cache_mux);
 }
 
 /**
@@ -6,6 +6,10 @@
 /**
  *
  * Simple SPIFFS based http server implementation capable of simple templating of html files
+ * SPIFFS is mounted in the background by webserver_init, requests are answered with 503 until it is ready
+ * NVS has to be initialized before webserver_init, it holds the generation of uploaded files used in ETags
+ * Pages of a callback set with webserver_set_cached_template_cb are cached until webserver_template_bump_version
+ * is called for them. Such a callback must write only with webserver_template_send(str), never httpd_resp_send_chunk
  *
  */
 
@@ -18,6 +22,12 @@ void webserver_stop(void);
 void webserver_destroy(void);
 
 void webserver_set_template_cb(web_template_cb_t cb);
+void webserver_set_cached_template_cb(web_template_cb_t cb);
 void webserver_set_api_cb(web_api_cb_t cb);
 
+esp_err_t webserver_template_send(httpd_req_t* req, const char* buf, size_t len);
+esp_err_t webserver_template_sendstr(httpd_req_t* req, const char* str);
+esp_err_t webserver_template_volatile(httpd_req_t* req);
+void webserver_template_bump_version(const char* filename);
+
 #endif
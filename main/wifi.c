@@ -8,6 +8,7 @@
 #include "lwip/err.h"
 #include <string.h>
 #include "mdns.h"
+#include "bootprof.h"
 
 #define NET_WIFI_STA_SSID CONFIG_WIFI_STATION_SSID
 #define NET_WIFI_STA_PASSWORD CONFIG_WIFI_STATION_PASSWORD
@@ -38,7 +39,11 @@ const int WIFI_CONNECTED_BIT = BIT0;
 
 static void event_handler_wifi(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
 {
-    if (event_id == WIFI_EVENT_AP_STACONNECTED)
+    if (event_id == WIFI_EVENT_AP_START)
+    {
+        bootprof_mark_once("ap_start");
+    }
+    else if (event_id == WIFI_EVENT_AP_STACONNECTED)
     {
         wifi_event_ap_staconnected_t* event = (wifi_event_ap_staconnected_t*) event_data;
         ESP_LOGI(TAG_AP, "station "MACSTR" joined, AID=%d", MAC2STR(event->mac), event->aid);
@@ -74,6 +79,7 @@ static void event_handler_ip(void* arg, esp_event_base_t event_base, int32_t eve
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
         ESP_LOGI(TAG_STA, "Received IP: %s", ip4addr_ntoa(&event->ip_info.ip));
         retry_num = 0;
+        bootprof_mark_once("sta_got_ip");
         xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
     }
 }
@@ -0,0 +1,204 @@
+#!/usr/bin/env python3
+"""
+Web asset pipeline for the storage partition
+
+Copies the web directory to the output directory and inlines small local
+scripts and stylesheets into the HTML pages that reference them, so a page
+loads with a single request. Scripts, styles and pages are minified with
+conservative rules that keep line structure and never touch string contents.
+
+Assets that stay external are announced with a "<page>.preload" file holding
+the value of a Link header, which the webserver sends with the page so the
+browser fetches them in parallel instead of after parsing the HTML.
+Assets inlined into every page that references them aren't copied at all.
+
+The template placeholder ($) is counted before and after processing every
+page, assets containing it are never inlined.
+
+Usage:
+    tools/build_assets.py web build/web --inline-limit 4096
+
+Only the python standard library is required.
+"""
+
+import argparse
+import os
+import re
+import shutil
+import sys
+
+PLACEHOLDER = "$"
+
+SCRIPT_RE = re.compile(r'<script\b([^>]*)\bsrc\s*=\s*"([^"]+)"([^>]*)>\s*</script>', re.IGNORECASE)
+STYLE_RE = re.compile(r'<link\b([^>]*)>', re.IGNORECASE)
+HREF_RE = re.compile(r'\bhref\s*=\s*"([^"]+)"', re.IGNORECASE)
+STYLESHEET_RE = re.compile(r'\brel\s*=\s*"stylesheet"', re.IGNORECASE)
+
+
+def is_local(url):
+    return not re.match(r"^([a-z]+:|//)", url, re.IGNORECASE)
+
+
+def minify_js(text):
+    #Template literals may span lines, their indentation is content
+    if "`" in text:
+        return text
+    lines = []
+    for line in text.splitlines():
+        line = line.strip()
+        #Only whole line comments, a // inside a line may belong to a string or regex
+        if not line or line.startswith("//"):
+            continue
+        lines.append(line)
+    return "\n".join(lines)
+
+
+def minify_css(text):
+    text = re.sub(r"/\*.*?\*/", "", text, flags=re.DOTALL)
+    return "\n".join(line.strip() for line in text.splitlines() if line.strip())
+
+
+def minify_html(text):
+    #Whitespace is content in these elements and in template literals of inline scripts
+    if "`" in text or re.search(r"<(pre|textarea)\b", text, re.IGNORECASE):
+        return text
+    text = re.sub(r"<!--(?!\[if).*?-->", "", text, flags=re.DOTALL)
+    return "\n".join(line.strip() for line in text.splitlines() if line.strip())
+
+
+MINIFIERS = {
+    ".js": minify_js,
+    ".css": minify_css,
+    ".html": minify_html,
+}
+
+
+class Page:
+    def __init__(self, src_root, path, inline_limit):
+        self.src_root = src_root
+        self.path = path
+        self.inline_limit = inline_limit
+        self.inlined = []
+        self.external = []
+        self.preload = []
+
+    def resolve(self, url):
+        """Maps the URL of an asset to its file and its absolute URL path"""
+        url = url.split("?")[0].split("#")[0]
+        if url.startswith("/"):
+            rel = url.lstrip("/")
+        else:
+            rel = os.path.normpath(os.path.join(os.path.dirname(os.path.relpath(self.path, self.src_root)), url))
+        return os.path.join(self.src_root, rel), "/" + rel.replace(os.sep, "/")
+
+    def load(self, url, ext):
+        """@return minified content of the asset or None if it stays external"""
+        if not is_local(url):
+            return None
+        filename, url_path = self.resolve(url)
+        if not os.path.isfile(filename):
+            print("warning: %s references missing %s" % (self.path, url), file=sys.stderr)
+            return None
+        with open(filename, encoding="utf-8") as f:
+            text = MINIFIERS[ext](f.read())
+        closing = "</script" if ext == ".js" else "</style"
+        if len(text.encode()) > self.inline_limit or PLACEHOLDER in text or closing in text.lower():
+            self.external.append(url_path)
+            self.preload.append("<%s>; rel=preload; as=%s" % (url_path, "script" if ext == ".js" else "style"))
+            return None
+        self.inlined.append(url_path)
+        return text
+
+    def inline_script(self, match):
+        text = self.load(match.group(2), ".js")
+        if text is None:
+            return match.group(0)
+        attrs = re.sub(r'\btype\s*=\s*"text/javascript"', "", match.group(1) + match.group(3), flags=re.IGNORECASE).strip()
+        return "<script%s>\n%s\n</script>" % ((" " + attrs) if attrs else "", text)
+
+    def inline_style(self, match):
+        href = HREF_RE.search(match.group(1))
+        if href is None or not STYLESHEET_RE.search(match.group(1)):
+            return match.group(0)
+        text = self.load(href.group(1), ".css")
+        if text is None:
+            return match.group(0)
+        return "<style>\n%s\n</style>" % text
+
+    def build(self):
+        with open(self.path, encoding="utf-8") as f:
+            src = f.read()
+        out = SCRIPT_RE.sub(self.inline_script, src)
+        out = STYLE_RE.sub(self.inline_style, out)
+        out = minify_html(out)
+        #Placeholders are numbered by position, a lost or added one shifts every following value
+        if out.count(PLACEHOLDER) != src.count(PLACEHOLDER):
+            raise SystemExit("error: placeholders of %s changed from %d to %d" % (self.path, src.count(PLACEHOLDER), out.count(PLACEHOLDER)))
+        return out
+
+
+def referenced(name, outputs, own):
+    """@return True if an output other than @param own mentions @param name, e.g. a script loading another one"""
+    return any(name in text for src, text in outputs.items() if src != own)
+
+
+def main(args):
+    if os.path.isdir(args.dst):
+        shutil.rmtree(args.dst)
+
+    sources = []
+    for root, _, files in os.walk(args.src):
+        sources += [os.path.join(root, name) for name in sorted(files)]
+
+    #Pages first, they decide which assets are still fetched by URL
+    outputs = {}
+    inlined = set()
+    external = set()
+    for src in sources:
+        ext = os.path.splitext(src)[1].lower()
+        if ext == ".html":
+            page = Page(args.src, src, args.inline_limit)
+            outputs[src] = page.build()
+            if page.preload:
+                outputs[src + ".preload"] = ", ".join(page.preload)
+            for url in page.inlined:
+                print("%s: inlined %s" % (os.path.relpath(src, args.src), url))
+            for link in page.preload:
+                print("%s: preload %s" % (os.path.relpath(src, args.src), link))
+            inlined.update(page.inlined)
+            external.update(page.external)
+        elif ext in MINIFIERS:
+            with open(src, encoding="utf-8") as f:
+                outputs[src] = MINIFIERS[ext](f.read())
+
+    total_src = 0
+    total_dst = 0
+    for src in sources + [name for name in outputs if name.endswith(".preload")]:
+        rel = os.path.relpath(src, args.src)
+        dst = os.path.join(args.dst, rel)
+        if os.path.isfile(src):
+            total_src += os.path.getsize(src)
+
+        url_path = "/" + rel.replace(os.sep, "/")
+        if url_path in inlined and url_path not in external and not referenced(os.path.basename(src), outputs, src):
+            print("%s: inlined everywhere, not copied" % rel)
+            continue
+
+        os.makedirs(os.path.dirname(dst), exist_ok=True)
+        if src in outputs:
+            with open(dst, "w", encoding="utf-8") as f:
+                f.write(outputs[src])
+        else:
+            shutil.copyfile(src, dst)
+        total_dst += os.path.getsize(dst)
+
+    print("assets: %d -> %d bytes" % (total_src, total_dst))
+    return 0
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("src", help="directory with the web sources")
+    parser.add_argument("dst", help="output directory packed into the storage partition")
+    parser.add_argument("--inline-limit", type=int, default=4096, help="largest script or stylesheet in bytes that is inlined")
+    sys.exit(main(parser.parse_args()))
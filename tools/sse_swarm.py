@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+"""
+SSE client swarm load generator
+
+Opens N concurrent connections to the EventSource endpoint and publishes
+timestamped events through the "echo" API call of the webserver.
+Every client measures the delivery latency of each echo event.
+The firmware has to be built with CONFIG_WEBIF_ECHO_API enabled.
+
+Usage:
+    tools/sse_swarm.py --host 192.168.138.1 --clients 5 --rate 50 --duration 10
+
+Only the python standard library is required.
+"""
+
+import argparse
+import asyncio
+import json
+import sys
+import time
+
+
+def percentile(values, p):
+    if not values:
+        return float("nan")
+    k = (len(values) - 1) * p
+    lo = int(k)
+    hi = min(lo + 1, len(values) - 1)
+    return values[lo] + (values[hi] - values[lo]) * (k - lo)
+
+
+class Client:
+    def __init__(self, index):
+        self.index = index
+        self.connected = False
+        self.latencies = []
+        self.received = 0
+        self.bytes = 0
+        self.seen = set()
+        self.error = None
+
+    async def run(self, host, port, endpoint, stop):
+        try:
+            reader, writer = await asyncio.open_connection(host, port)
+        except OSError as e:
+            self.error = str(e)
+            return
+
+        writer.write(("GET %s HTTP/1.1\r\nHost: %s\r\nAccept: text/event-stream\r\n\r\n" % (endpoint, host)).encode())
+        await writer.drain()
+
+        try:
+            status = await reader.readline()
+            if b" 200 " not in status:
+                self.error = status.decode(errors="replace").strip() or "connection closed"
+                return
+            #Skip response headers
+            while (await reader.readline()) not in (b"\r\n", b"\n", b""):
+                pass
+            self.connected = True
+
+            event = None
+            data = None
+            while not stop.is_set():
+                line = await reader.readline()
+                if not line:
+                    self.error = "connection closed"
+                    break
+                now = time.monotonic_ns()
+                self.bytes += len(line)
+                line = line.rstrip(b"\r\n")
+                if line.startswith(b"event: "):
+                    event = line[7:]
+                elif line.startswith(b"data: "):
+                    data = line[6:]
+                elif not line:
+                    if event == b"echo" and data:
+                        self.on_echo(data, now)
+                    event = None
+                    data = None
+        except (OSError, asyncio.IncompleteReadError) as e:
+            self.error = str(e)
+        finally:
+            writer.close()
+
+    def on_echo(self, data, now):
+        try:
+            seq, sent = data.split(b":")
+            seq = int(seq)
+            sent = int(sent)
+        except ValueError:
+            return
+        if seq in self.seen:
+            return
+        self.seen.add(seq)
+        self.received += 1
+        self.latencies.append((now - sent) / 1e6)
+
+
+class Publisher:
+    """Publishes echo events through the webserver API using one keep-alive connection"""
+
+    def __init__(self):
+        self.sent = 0
+        self.failed = 0
+
+    async def request(self, host, port, seq):
+        path = "/api/echo=%d:%d" % (seq, time.monotonic_ns())
+        self.writer.write(("POST %s HTTP/1.1\r\nHost: %s\r\nContent-Length: 0\r\n\r\n" % (path, host)).encode())
+        await self.writer.drain()
+
+        status = await self.reader.readline()
+        length = 0
+        chunked = False
+        while True:
+            line = await self.reader.readline()
+            if line in (b"\r\n", b"\n", b""):
+                break
+            name, _, value = line.decode(errors="replace").partition(":")
+            if name.lower() == "content-length":
+                length = int(value)
+            elif name.lower() == "transfer-encoding" and "chunked" in value.lower():
+                chunked = True
+        if chunked:
+            while True:
+                size = int((await self.reader.readline()).strip() or b"0", 16)
+                await self.reader.readexactly(size + 2)
+                if size == 0:
+                    break
+        elif length:
+            await self.reader.readexactly(length)
+        return b" 200 " in status
+
+    async def run(self, host, port, rate, duration, stop):
+        self.reader, self.writer = await asyncio.open_connection(host, port)
+        interval = 1.0 / rate
+        start = time.monotonic()
+        seq = 0
+        while time.monotonic() - start < duration:
+            try:
+                ok = await self.request(host, port, seq)
+            except (OSError, asyncio.IncompleteReadError, ValueError):
+                self.writer.close()
+                self.reader, self.writer = await asyncio.open_connection(host, port)
+                ok = False
+            if ok:
+                self.sent += 1
+            else:
+                self.failed += 1
+            seq += 1
+            delay = start + seq * interval - time.monotonic()
+            if delay > 0:
+                await asyncio.sleep(delay)
+        self.writer.close()
+        stop.set()
+
+
+async def main(args):
+    stop = asyncio.Event()
+    clients = [Client(i) for i in range(args.clients)]
+    tasks = [asyncio.create_task(c.run(args.host, args.sse_port, args.endpoint, stop)) for c in clients]
+
+    #Give the server time to accept every client before publishing
+    await asyncio.sleep(args.warmup)
+
+    publisher = Publisher()
+    start = time.monotonic()
+    await publisher.run(args.host, args.http_port, args.rate, args.duration, stop)
+    #Wait for in flight events
+    await asyncio.sleep(args.drain)
+    elapsed = time.monotonic() - start
+    for t in tasks:
+        t.cancel()
+    await asyncio.gather(*tasks, return_exceptions=True)
+
+    connected = [c for c in clients if c.connected]
+    latencies = sorted(l for c in connected for l in c.latencies)
+    received = sum(c.received for c in connected)
+    expected = publisher.sent * len(connected)
+
+    result = {
+        "clients": args.clients,
+        "connected": len(connected),
+        "rate": args.rate,
+        "published": publisher.sent,
+        "publish_failed": publisher.failed,
+        "received": received,
+        "dropped": max(expected - received, 0),
+        "throughput_events_per_s": received / elapsed,
+        "throughput_bytes_per_s": sum(c.bytes for c in connected) / elapsed,
+        "latency_ms": {
+            "p50": percentile(latencies, 0.50),
+            "p99": percentile(latencies, 0.99),
+            "p999": percentile(latencies, 0.999),
+            "max": latencies[-1] if latencies else float("nan"),
+        },
+        "errors": sorted(set(c.error for c in clients if c.error)),
+    }
+
+    if args.json:
+        json.dump(result, sys.stdout, indent=2)
+        print()
+    else:
+        print("clients:    %d/%d connected" % (result["connected"], result["clients"]))
+        print("published:  %d (%d failed)" % (result["published"], result["publish_failed"]))
+        print("received:   %d (%d dropped)" % (result["received"], result["dropped"]))
+        print("throughput: %.1f events/s, %.1f kB/s" % (result["throughput_events_per_s"], result["throughput_bytes_per_s"] / 1000))
+        print("latency:    p50 %.2f ms, p99 %.2f ms, p999 %.2f ms, max %.2f ms" % tuple(result["latency_ms"][k] for k in ("p50", "p99", "p999", "max")))
+        for error in result["errors"]:
+            print("error:      %s" % error)
+
+    return 0 if result["connected"] == args.clients and result["dropped"] == 0 else 1
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--sse-port", type=int, default=8080)
+    parser.add_argument("--http-port", type=int, default=80)
+    parser.add_argument("--endpoint", default="/api.sse")
+    parser.add_argument("--clients", type=int, default=5, help="number of concurrent SSE connections")
+    parser.add_argument("--rate", type=float, default=20, help="published events per second")
+    parser.add_argument("--duration", type=float, default=10, help="publishing time in seconds")
+    parser.add_argument("--warmup", type=float, default=1, help="seconds to wait for clients to connect")
+    parser.add_argument("--drain", type=float, default=1, help="seconds to wait for outstanding events")
+    parser.add_argument("--json", action="store_true", help="print machine readable results")
+    sys.exit(asyncio.run(main(parser.parse_args())))
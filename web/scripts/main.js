@@ -1,15 +1,76 @@
-const eventSource = new EventSource(window.location.origin + ":8080/api.sse");
+const streamOrigin = window.location.origin + ":8080";
+const eventHandlers = {};
+let eventSource = null;
+let socket = null;
+
+function openEventSource() {
+    eventSource = new EventSource(streamOrigin + "/api.sse");
+    for (const name in eventHandlers) {
+        eventSource.addEventListener(name, eventHandlers[name]);
+    }
+}
+
+function onEvent(name, handler) {
+    eventHandlers[name] = handler;
+    if (eventSource) eventSource.addEventListener(name, handler);
+}
+
+//Every WebSocket message is one event in the Server-Sent-Events format
+function dispatchSocketMessage(msg) {
+    let event = "message";
+    let data = [];
+    for (const line of msg.data.split("\n")) {
+        if (line.startsWith("event: ")) event = line.substring(7);
+        else if (line.startsWith("data: ")) data.push(line.substring(6));
+    }
+    if (eventHandlers[event]) eventHandlers[event]({ type: event, data: data.join("\n") });
+}
+
+//Prefer the WebSocket for low latency API calls, fall back to EventSource and XHR
+function openSocket() {
+    const ws = new WebSocket(streamOrigin.replace(/^http/, "ws") + "/api.ws");
+    ws.onopen = function() {
+        socket = ws;
+        if (eventSource) eventSource.close();
+        eventSource = null;
+    };
+    ws.onmessage = dispatchSocketMessage;
+    ws.onclose = function() {
+        const wasOpen = (socket === ws);
+        socket = null;
+        if (!eventSource) openEventSource();
+        if (wasOpen) setTimeout(openSocket, 5000);
+    };
+}
 
 function apiRequestSimple(req) {
+    if (socket) {
+        socket.send(req);
+        return;
+    }
     var xhr = new XMLHttpRequest();
     xhr.open("POST", "/api/" + req);
     xhr.send();
 }
 
-eventSource.addEventListener("reset", function(evt) {
-	
+//Executes many API calls with one request, the response has one status line per call
+function apiRequestBatch(reqs) {
+    if (socket) {
+        reqs.forEach(function(req) { socket.send(req); });
+        return;
+    }
+    var xhr = new XMLHttpRequest();
+    xhr.open("POST", "/api/batch");
+    xhr.send(reqs.join("\n"));
+}
+
+onEvent("reset", function(evt) {
+
 });
 
+openEventSource();
+openSocket();
+
 document.getElementById('xxxx').onclick = function() {
     apiRequestSimple("xxxxx");
 };